@@ -39,22 +39,142 @@ void post(sema_t *sema) {
 		++sema->count;
 }
 
+/*
+ * mutex_t is a mutual exclusion lock. By default,
+ * unlock() hands the lock directly to the next waiter,
+ * which is fair, but every contended acquisition then
+ * waits for a trip through the run queue, and tasks that
+ * take the lock repeatedly convoy behind one another.
+ *
+ * A mutex with 'barging' set (use MUTEX_BARGING as its
+ * initializer) favors throughput instead: unlock() releases
+ * the lock and wakes one waiter, and a task that is already
+ * running may take the lock before that waiter gets to run,
+ * in which case the waiter waits again, ahead of the rest.
+ * A waiter that loses MUTEX_BARGE_LIMIT times puts the mutex
+ * into handoff mode until that waiter has the lock, so nobody
+ * starves.
+ */
 typedef struct {
 	tasklist_t waiting;
-	int        locked;
+	tasklist_t front;    /* a woken waiter that lost the lock to a barger */
+	int        locked;   /* 1 if held; 2 if reserved for the woken waiter */
+	int        barging;
+	int        woken;    /* a waiter has been woken, but hasn't run yet */
+	int        starving; /* hand off, even though 'barging' is set */
 } mutex_t;
 
+#define MUTEX_BARGING { { NULL, NULL }, { NULL, NULL }, 0, 1, 0, 0 }
+#define MUTEX_BARGE_LIMIT 4
+
+/* the rest of lock(), once unlock() has woken us from mutex->waiting */
+void __lock_woken(mutex_t *mutex) {
+	if (!mutex->barging)
+		return; /* it was handed to us */
+
+	int tries;
+	for (tries = 1; ; ++tries) {
+		mutex->woken = 0;
+		if (mutex->locked != 1)
+			break;
+
+		/* 
+		 * Someone barged in; we're woken next. (Only one
+		 * waiter is woken at a time, so 'front' never holds
+		 * more than one task, and a starving mutex is always
+		 * starving us.)
+		 */
+		if (tries >= MUTEX_BARGE_LIMIT)
+			mutex->starving = 1;
+		wait(&mutex->front);
+	}
+	mutex->locked = 1;
+	mutex->starving = 0;
+}
+
+/* wake the next waiter in line */
+int __mutex_wake(mutex_t *mutex) {
+	return wake(&mutex->front) || wake(&mutex->waiting);
+}
+
 void lock(mutex_t *mutex) {
-	if (mutex->locked) {
-		wait(&mutex->waiting);
-	} else {
+	if (!mutex->locked && !mutex->starving) {
 		mutex->locked = 1;
+		return;
 	}
+	wait(&mutex->waiting);
+	__lock_woken(mutex);
 }
 
 void unlock(mutex_t *mutex) {
-	assert(mutex->locked);
-	mutex->locked = wake(&mutex->waiting);
+	assert(mutex->locked == 1);
+	if (!mutex->barging) {
+		mutex->locked = wake(&mutex->waiting);
+		return;
+	}
+
+	if (mutex->starving) {
+		/* reserve it for the next waiter to run */
+		mutex->locked = 2;
+		if (!mutex->woken && !(mutex->woken = __mutex_wake(mutex))) {
+			mutex->locked = 0;
+			mutex->starving = 0;
+		}
+		return;
+	}
+	mutex->locked = 0;
+	if (!mutex->woken)
+		mutex->woken = __mutex_wake(mutex);
+}
+
+/*
+ * cond_t is a condition variable. cond_wait() unlocks
+ * 'mutex', waits for cond_signal() or cond_broadcast(),
+ * and returns with 'mutex' locked again. Every waiter must
+ * use the same mutex.
+ *
+ * Rather than waking waiters, cond_signal() and
+ * cond_broadcast() move them (one, or all of them) onto
+ * the mutex's line of waiters, so they run one at a time as
+ * the mutex is unlocked, instead of all waking up at once
+ * only to wait for the mutex again. Either may be called
+ * with or without the mutex held.
+ */
+typedef struct {
+	tasklist_t waiting;
+	mutex_t    *mutex;
+} cond_t;
+
+void cond_wait(cond_t *cond, mutex_t *mutex) {
+	assert(cond->mutex == NULL || cond->mutex == mutex || cond->waiting.top == NULL);
+	cond->mutex = mutex;
+	unlock(mutex);
+	wait(&cond->waiting);
+
+	/* by now, we've been moved to mutex->waiting and woken from there */
+	__lock_woken(mutex);
+}
+
+/* the mutex may be free, in which case nobody would wake the waiters we moved */
+void __cond_moved(mutex_t *mutex) {
+	if (!mutex->locked) {
+		mutex->locked = 1;
+		unlock(mutex);
+	}
+}
+
+void cond_signal(cond_t *cond) {
+	if (cond->waiting.top == NULL)
+		return;
+	requeue(&cond->waiting, &cond->mutex->waiting, 1);
+	__cond_moved(cond->mutex);
+}
+
+void cond_broadcast(cond_t *cond) {
+	if (cond->waiting.top == NULL)
+		return;
+	requeue(&cond->waiting, &cond->mutex->waiting, -1);
+	__cond_moved(cond->mutex);
 }
 
 #endif
@@ -20,9 +20,186 @@ typedef union {
  */
 void spawn(void (start)(word_t), word_t data);
 
+/* the largest argument accepted by spawn_with() */
+#define SPAWN_WITH_MAX 256
+
+/*
+ * spawn_with() is like spawn(), but it copies 'len'
+ * bytes starting at 'arg' onto the top of the new task's
+ * stack, and passes the task a pointer to the copy (in
+ * data.ptr). The copy is suitably aligned for any type, and
+ * it lives as long as the task does. 'len' must be no larger
+ * than SPAWN_WITH_MAX.
+ */
+void spawn_with(void (start)(word_t), const void *arg, size_t len);
+
+/*
+ * spawn_budget() sets the number of live tasks below
+ * which spawn() allocates a new task immediately, rather
+ * than parking the caller until the scheduler proves that
+ * the allocation is necessary. (Every task costs 12kB of
+ * stack, so a budget of N tasks is N*12kB of memory.) Once
+ * the budget is exhausted, spawn() falls back to deferred
+ * allocation. The default budget is zero, i.e. always defer.
+ */
+void spawn_budget(int tasks);
+
+/*
+ * spawn_limit() caps the number of live tasks (not
+ * counting main()). Once the cap is reached, spawn()
+ * parks the caller until a task exits; callers are
+ * admitted in FIFO order. A limit of zero (the default)
+ * means no limit.
+ */
+void spawn_limit(int tasks);
+
+/*
+ * poll_budget() bounds how long tasks that are ready for
+ * I/O can be kept waiting by tasks that keep the run queue
+ * busy. Ordinarily the scheduler only polls for I/O once
+ * there is nothing left to run; in addition, it polls
+ * (without blocking) after every 'switches' context switches,
+ * and, if 'usec' is non-zero, once that many microseconds have
+ * passed since the last poll (the clock is read every 16
+ * switches). Either can be disabled with 0. Tasks woken by
+ * these polls join the back of the run queue, or the front
+ * if 'io_first' is non-zero. The default is poll_budget(1024, 0, 0).
+ */
+void poll_budget(int switches, int usec, int io_first);
+
+/*
+ * overload_control() turns on load shedding for the calling
+ * thread's runtime. The scheduler tracks how long tasks wait
+ * in the run queue before they run; if, for 'interval_ms'
+ * milliseconds, no task waited less than 'target_usec'
+ * microseconds, the runtime is overloaded until a task waits
+ * less than that again, or the run queue empties. (This is
+ * the CoDel rule: a queue that never drains is a standing
+ * queue, not a burst.) overload_control(0, 0) turns it off.
+ *
+ * chip_overloaded() returns non-zero while the runtime is
+ * overloaded, so that handlers can do less work (skip
+ * optional features, fail fast) until it recovers. See
+ * also ioctx_shed().
+ */
+void overload_control(int target_usec, int interval_ms);
+int chip_overloaded(void);
+
+/*
+ * try_spawn() is like spawn(), but it never blocks.
+ * On success, 0 is returned. If the task limit has been
+ * reached, or other spawns are already waiting in line for
+ * a task, -1 is returned and errno is set to EAGAIN. If
+ * the task heap cannot be grown, -1 is returned and errno
+ * is set to ENOMEM.
+ */
+int try_spawn(void (start)(word_t), word_t data);
+
+/*
+ * spawn_inline() queues a call to fn(arg) to be run
+ * to completion by the scheduler. Queued calls are run
+ * in FIFO order, back-to-back on a shared stack, so they
+ * cost neither a stack allocation nor a context switch
+ * apiece. A call that blocks (in wait() or on I/O) is
+ * transparently given the stack it is running on, and the
+ * remaining calls continue on a new one. Those stacks
+ * count against spawn_limit(): at the limit, queued calls
+ * wait for a task to exit, and spawn_inline() never blocks.
+ */
+void spawn_inline(void (fn)(word_t), word_t arg);
+
 /* yield to the scheduler; may return immediately */
 void sched(void);
 
+/*
+ * Every thread has its own, independent runtime:
+ * tasks, the task heap and the poller all belong to
+ * the thread that created them, and tasks never migrate.
+ * chip_init() sets up the calling thread's runtime; it
+ * runs automatically for the main thread, and must be called
+ * by any other thread before it uses the runtime.
+ */
+void chip_init(void);
+
+/* chip_rt_t is an opaque handle to a thread's runtime */
+typedef struct chip_rt_s chip_rt_t;
+
+/*
+ * chip_self() returns the calling thread's runtime,
+ * and opens its mailbox so that other threads can
+ * chip_post() to it. (A thread with an open mailbox
+ * never reports deadlock; it waits for mail instead.)
+ * On error, NULL is returned, and errno will be set.
+ */
+chip_rt_t *chip_self(void);
+
+/*
+ * chip_post() arranges for fn(arg) to be run on
+ * the given runtime, as if by spawn_inline(). (To start
+ * a task there, post a function that calls spawn().) It
+ * may be called from any thread, and it never blocks. On
+ * success, 0 is returned. If the target's mailbox is full,
+ * -1 is returned and errno is set to EAGAIN.
+ */
+int chip_post(chip_rt_t *rt, void (fn)(word_t), word_t arg);
+
+/*
+ * chip_watchdog() starts a thread that watches the calling
+ * thread's runtime for tasks that run for more than 'ms'
+ * milliseconds without blocking or yielding. Each such stall
+ * is reported on stderr, along with the address of the task's
+ * start function, and the task is asked to yield at its next
+ * preemption point: a call to chip_maybe_yield(), or a
+ * successful ioctx_read() or ioctx_write(). chip_watchdog(0)
+ * stops the watchdog and waits (briefly) for its thread to
+ * exit, which must be done before the calling thread exits.
+ * On success, 0 is returned. On error, -1 is returned, and
+ * errno will be set.
+ *
+ * chip_maybe_yield() calls sched() if the watchdog has asked
+ * the running task to yield, and otherwise returns right away,
+ * so it is cheap enough to call from inside long loops.
+ */
+int chip_watchdog(int ms);
+void chip_maybe_yield(void);
+
+/*
+ * chip_profile_start() starts sampling the calling thread's
+ * CPU use 'hz' times per second of CPU time (with SIGPROF, so
+ * the program mustn't use ITIMER_PROF itself; the rate is
+ * shared by every profiling thread, and is limited by the
+ * kernel's timer resolution). Each sample records the
+ * running task, its start function, and up to 30 frames of
+ * its stack, found by following frame pointers, so build with
+ * -fno-omit-frame-pointer for anything deeper than the
+ * innermost frame. chip_profile_stop() stops sampling.
+ *
+ * chip_profile_write() writes the samples taken so far to 'fd'
+ * as "folded stacks" (one line per distinct stack, rooted at
+ * the task's start function, followed by a count), which
+ * flame graph tools accept once the addresses are symbolized
+ * (e.g. with addr2line). With CHIP_PROFILE_TASKS in 'flags',
+ * each task gets its own subtree. Up to 4096 samples are kept
+ * between writes; the rest are only counted. It doesn't use
+ * printf(), so it may be called from any task. On success, 0
+ * is returned. On error, -1 is returned, and errno will be set.
+ */
+#define CHIP_PROFILE_TASKS 1
+int chip_profile_start(int hz);
+void chip_profile_stop(void);
+int chip_profile_write(int fd, int flags);
+
+/*
+ * chip_call_on_system_stack() calls fn(arg) on a large
+ * (1MB) stack shared by every task, and returns once fn
+ * does. Use it for stack-hungry code (printf() and friends,
+ * getaddrinfo(), deep recursion) that would otherwise overflow
+ * a task's stack. fn must not block: calling wait(), or doing
+ * I/O that would park the task, aborts the program. (Calls that
+ * don't block, like spawn_inline() or wake(), are fine.)
+ */
+void chip_call_on_system_stack(void (fn)(word_t), word_t arg);
+
 typedef struct {
 	int runnable; /* number of currently-runnable tasks */
 	int parked;   /* number of parked tasks */
@@ -39,6 +216,70 @@ typedef struct {
  */
 void get_tsk_stats(tsk_stats_t *);
 
+typedef struct {
+	int           live;      /* number of allocated tasks */
+	int           highwater; /* most tasks ever allocated at once */
+	int           limit;     /* see spawn_limit(); 0 if unlimited */
+	unsigned long denied;    /* spawns that waited on or failed at the limit */
+	size_t        mapped;    /* bytes of memory mapped for the task heap */
+} heap_stats_t;
+
+/*
+ * get_heap_stats() returns task heap counters.
+ * Unlike get_tsk_stats(), it is cheap enough to
+ * call from production code.
+ */
+void get_heap_stats(heap_stats_t *);
+
+#define HIST_BUCKETS 64
+
+/*
+ * A hist_t is a histogram with power-of-two buckets:
+ * buckets[0] counts zeros, and buckets[i] counts values
+ * in [2^(i-1), 2^i). 'sum' is the sum of every value.
+ */
+typedef struct {
+	uint64_t count;
+	uint64_t sum;
+	uint64_t buckets[HIST_BUCKETS];
+} hist_t;
+
+typedef struct {
+	hist_t runq_delay;  /* ns from becoming runnable to running */
+	hist_t poll_events; /* tasks woken per poll */
+	hist_t poll_block;  /* ns spent in each blocking poll */
+	hist_t runq_len;    /* run queue length at each poll */
+	hist_t lifetime;    /* ns from spawn to exit */
+} sched_stats_t;
+
+/*
+ * get_sched_stats() returns the calling thread's scheduler
+ * histograms. The time-valued ones (and so the switch count
+ * in runq_delay) cost a cycle-counter read or two per context
+ * switch, so they are only kept once sched_stats_start() has
+ * been called; until then, they read as zeros. (Nothing turns
+ * them off again. overload_control() also starts them, since
+ * it needs the run queue delays.) poll_events and runq_len
+ * are always kept. On architectures where the cycle counter
+ * isn't in nanoseconds, times are converted at snapshot time,
+ * which is approximate to within a bucket.
+ */
+void sched_stats_start(void);
+void get_sched_stats(sched_stats_t *stats);
+
+/*
+ * chip_stats_publish() makes the calling thread's runtime
+ * publish its counters (task states, task heap usage, and
+ * switch, poll and syscall counts) to a shared memory segment,
+ * "/chip-<pid>" (see chip/stats.h), which tools/chiptop can
+ * display while the process runs. The counters are refreshed
+ * after every poll and every 4096 context switches. Setting
+ * CHIP_STATS in the environment does this for every thread
+ * when chip_init() runs. On success, 0 is returned. On
+ * error, -1 is returned, and errno will be set.
+ */
+int chip_stats_publish(void);
+
 /*
  * The following primitives can be used
  * to build higher-level synchronization 
@@ -84,6 +325,56 @@ int wake(tasklist_t *list);
  */
 int wakeall(tasklist_t *list);
 
+/*
+ * requeue() moves the first 'n' tasks waiting on 'from'
+ * to the back of 'to', without waking them, and returns
+ * the number moved. If 'n' is negative, every task is
+ * moved, in constant time, and the return value is only
+ * non-zero if there were any.
+ */
+int requeue(tasklist_t *from, tasklist_t *to, int n);
+
+/*
+ * A group_t is a set of tasks to be joined as a whole.
+ * Like the ioctx_t, its contents should only be read,
+ * not written, outside of the group_XXX functions.
+ */
+typedef struct {
+	word_t     *results;  /* one per member, in order */
+	int        cap;
+	int        spawned;   /* members so far */
+	int        running;   /* members that haven't exited */
+	int        finished;  /* members whose start function returned */
+	int        canceled;
+	tasklist_t joiners;
+} group_t;
+
+/*
+ * group_init() initializes an empty group. If 'results' is
+ * not NULL, it holds up to 'cap' members, and each member's
+ * return value is stored in the element given by its index.
+ *
+ * group_spawn() is like spawn(), but 'fn' returns a result,
+ * and the new task is a member of 'g'. It returns the member's
+ * index (0, 1, ...). If the group has been canceled, -1 is
+ * returned and errno is set to ECANCELED; if 'results' is full,
+ * -1 is returned and errno is set to ENOSPC.
+ *
+ * group_cancel() keeps members that haven't started yet
+ * from ever running (their results are zero), and stops
+ * further calls to group_spawn(). Members that are already
+ * running can check g->canceled to stop early.
+ *
+ * group_join() blocks until every member has exited and
+ * returns the number whose start function ran to completion.
+ * The last member to exit switches directly to the joiner.
+ * The group must not be freed until it has been joined.
+ */
+void group_init(group_t *g, word_t *results, int cap);
+int group_spawn(group_t *g, word_t (fn)(word_t), word_t arg);
+void group_cancel(group_t *g);
+int group_join(group_t *g);
+
 /*
  * An ioctx_t represents a file descriptor 
  * and its I/O state. It serves as a mediator 
@@ -92,10 +383,16 @@ int wakeall(tasklist_t *list);
  * opaque, and only mutate it through calls to 
  * the ioctx_XXX family of functions.
  */
+typedef struct iocork_s iocork_t;
+typedef struct ioctx_stats_s ioctx_stats_t;
+
 typedef struct {
 	int fd;
-	task_t *writer;
-	task_t *reader;
+	int flags;
+	tasklist_t writers;
+	tasklist_t readers;
+	iocork_t *cork;
+	ioctx_stats_t *stats;
 } ioctx_t;
 
 /*
@@ -104,6 +401,17 @@ typedef struct {
  * The file descriptor must already have O_NONBLOCK
  * set. On success, 0 is returned. On error,
  * -1 is returned, and errno will be set.
+ *
+ * Descriptors that can't be polled (like regular
+ * files) are accepted, but reads and writes on them
+ * block the scheduler; use ioctx_pread() and ioctx_pwrite()
+ * instead.
+ *
+ * ioctx_init() doesn't validate the descriptor: it isn't
+ * registered with the poller until an operation on it would
+ * block, and errors from registering are reported by that
+ * operation. (If the poller refuses it as unpollable, the
+ * operation yields and retries instead.)
  */
 int ioctx_init(int fd, ioctx_t *ctx);
 
@@ -132,13 +440,98 @@ int ioctx_destroy(ioctx_t *ctx);
  * says the fd is writeable. The write will also 
  * be re-tried on EINTR.
  *
- * Two tasks trying to perform writes on the
- * same fd at the same time will have undefined 
- * behavior, but the program may abort if the runtime
- * notices.
+ * Any number of tasks may wait to write to the same
+ * ioctx. They are woken one at a time, in the order
+ * in which they blocked: each time the fd becomes writeable,
+ * and again each time a woken task's write succeeds. (Each
+ * call is a separate write(), so concurrent writes to a
+ * stream may interleave.)
+ *
+ * If the ioctx is corked (see ioctx_cork()), the data
+ * is buffered instead, and the write only goes to the
+ * operating system once the buffer would overflow.
  */
 ssize_t ioctx_write(ioctx_t *ctx, char *buf, size_t bytes);
 
+/*
+ * An iocork_t buffers writes to an ioctx_t. Like
+ * the ioctx_t itself, its contents are opaque.
+ */
+struct iocork_s {
+	ioctx_t  *ctx;
+	char     *buf;
+	size_t   cap;
+	size_t   len;   /* bytes buffered */
+	int      err;   /* error from a background flush */
+	task_t   *owner; /* task that flushes the buffer when it blocks */
+	iocork_t *next;  /* owner's other corks with buffered data */
+};
+
+/*
+ * ioctx_cork() makes subsequent calls to ioctx_write()
+ * on 'ctx' copy into the 'cap'-byte buffer 'buf'. When
+ * a write wouldn't fit, the buffered data and the new data
+ * are written together with one writev(). Buffered data is
+ * also written out (without blocking) right before the task
+ * that wrote it blocks, yields, or exits, so a task that
+ * answers several requests and then waits for more issues
+ * one syscall per batch rather than one per reply. Anything
+ * the operating system won't take at that point is sent
+ * when the fd becomes writeable again; an error encountered
+ * while doing so is returned by the next ioctx_write() or
+ * ioctx_flush().
+ *
+ * 'cork' and 'buf' must stay valid until ioctx_uncork()
+ * or ioctx_destroy(). An ioctx_t that is already corked
+ * must be uncorked before it is corked again.
+ *
+ * ioctx_flush() writes out any buffered data, blocking if
+ * necessary, and returns 0 on success or -1 on error with errno
+ * set. ioctx_uncork() flushes and then detaches the buffer.
+ * ioctx_destroy() discards buffered data that can't be
+ * written without blocking, so flush first if it matters.
+ */
+void ioctx_cork(ioctx_t *ctx, iocork_t *cork, char *buf, size_t cap);
+int ioctx_flush(ioctx_t *ctx);
+int ioctx_uncork(ioctx_t *ctx);
+
+/*
+ * An ioctx_stats_t holds the counters that ioctx_track()
+ * keeps for one ioctx_t. The caller may read them at any
+ * time; the links are only for ioctx_tracked().
+ */
+struct ioctx_stats_s {
+	ioctx_t       *ctx;     /* NULL once the ioctx is destroyed */
+	uint64_t      rbytes;   /* bytes read */
+	uint64_t      wbytes;   /* bytes written */
+	uint64_t      syscalls; /* reads, writes, accepts, etc. */
+	uint64_t      eagain;   /* syscalls that would have blocked */
+	uint64_t      parks;    /* times a task waited for the fd */
+	uint64_t      events;   /* readiness events from the poller */
+	int64_t       iowait;   /* nanoseconds tasks spent waiting */
+	ioctx_stats_t *prev, *next;
+};
+
+/*
+ * ioctx_track() zeroes 'stats' and starts counting the
+ * I/O done through 'ctx' in it, until ioctx_destroy(). The
+ * counters are only updated on tracked ioctxs, so untracked
+ * ones cost nothing extra. 'stats' must stay valid until
+ * the ioctx is destroyed. It may be uninitialized, or left
+ * over from an ioctx that has since been destroyed, but it
+ * must not be tracking another live ioctx: it is linked in
+ * without being unlinked from wherever it was. (Tracking a
+ * new 'stats' on the same 'ctx' is fine; the old one is
+ * unlinked first.)
+ *
+ * ioctx_tracked() iterates over the calling thread's live
+ * tracked ioctxs: ioctx_tracked(NULL) returns the most
+ * recently tracked one, ioctx_tracked(s) the one tracked
+ * before 's', and NULL follows the last one.
+ */
+void ioctx_track(ioctx_t *ctx, ioctx_stats_t *stats);
+ioctx_stats_t *ioctx_tracked(ioctx_stats_t *prev);
+
 /*
  * ioctx_read() reads into the buffer starting
  * at 'buf' up to 'bytes' bytes, and returns
@@ -151,12 +544,87 @@ ssize_t ioctx_write(ioctx_t *ctx, char *buf, size_t bytes);
  * says the fd is readable. The read will also 
  * be re-tried on EINTR.
  *
- * Two tasks trying to perform reads on the same
- * fd at the same time will have undefined behavior,
- * but may abort the program if the runtime notices.
+ * Like writers, any number of tasks may wait to read
+ * from the same ioctx (for instance, a pool of workers
+ * sharing a datagram socket). Only one of them is woken
+ * when the fd becomes readable; that task wakes the next
+ * once its read succeeds, so waiters take turns rather
+ * than stampeding.
  */
 ssize_t ioctx_read(ioctx_t *ctx, char *buf, size_t bytes);
 
+/*
+ * iobuf_get() returns a buffer of at least 'size'
+ * bytes (and at most 64kB) from a per-thread pool. On
+ * error, NULL is returned, and errno will be set. Buffers
+ * are returned to the pool with iobuf_put(), which must be
+ * called on the same thread. iobuf_size() returns the
+ * usable size of a buffer.
+ */
+char *iobuf_get(size_t size);
+void iobuf_put(char *buf);
+size_t iobuf_size(const char *buf);
+
+/*
+ * ioctx_read_pooled() is like ioctx_read(), except that
+ * it takes a buffer of 'bytes' bytes from the iobuf pool
+ * only once there is data to read, so a task that is waiting
+ * for input holds no buffer. When data is read, *buf is set to
+ * the (filled) buffer, which the caller must release with
+ * iobuf_put(). At EOF or on error, *buf is set to NULL.
+ */
+ssize_t ioctx_read_pooled(ioctx_t *ctx, size_t bytes, char **buf);
+
+/*
+ * An ioreader_t buffers reads from an ioctx_t for
+ * line- and frame-oriented protocols. Every read fills
+ * as much of the buffer as the fd will allow, so a single
+ * system call can serve many pipelined messages. Users should
+ * treat its contents as opaque.
+ */
+typedef struct {
+	ioctx_t *ctx;
+	char    *buf;
+	size_t  cap;
+	size_t  start; /* first unconsumed byte */
+	size_t  end;   /* end of buffered data */
+	size_t  scan;  /* bytes past 'start' known not to hold a delimiter */
+} ioreader_t;
+
+/*
+ * ioreader_init() initializes a reader on 'ctx' that
+ * buffers into the 'cap' bytes at 'buf' (which could come
+ * from iobuf_get()). No message can be longer than 'cap'.
+ */
+void ioreader_init(ioreader_t *rd, ioctx_t *ctx, char *buf, size_t cap);
+
+/*
+ * ioctx_read_until() reads up to and including the first
+ * occurrence of the 'dlen'-byte delimiter 'delim', and
+ * returns the length of the message. *out is set to point
+ * to the message, which lives in the reader's buffer and is
+ * only valid until the next call on the reader. At EOF, 0 is
+ * returned (and any partial message can be seen with ioctx_peek()).
+ * On error, -1 is returned, and errno will be set; if the buffer
+ * fills up without a delimiter, errno is ENOBUFS; if 'dlen'
+ * is zero, it is EINVAL.
+ */
+ssize_t ioctx_read_until(ioreader_t *rd, const char *delim, size_t dlen, char **out);
+
+/*
+ * ioctx_read_exact() reads exactly 'n' bytes, and otherwise
+ * behaves like ioctx_read_until(). If 'n' is larger than
+ * the reader's buffer, -1 is returned and errno is set to EINVAL.
+ */
+ssize_t ioctx_read_exact(ioreader_t *rd, size_t n, char **out);
+
+/*
+ * ioctx_peek() returns the number of buffered bytes,
+ * and points *out to them, without consuming them. If
+ * nothing is buffered, it reads first. At EOF, 0 is returned.
+ */
+ssize_t ioctx_peek(ioreader_t *rd, char **out);
+
 /*
  * ioctx_accept() is analagous to
  *
@@ -170,6 +638,153 @@ ssize_t ioctx_read(ioctx_t *ctx, char *buf, size_t bytes);
  */
 int ioctx_accept(ioctx_t *ctx, struct sockaddr *addr, socklen_t *addrlen);
 
+/*
+ * ioctx_accept_n() is like ioctx_accept(), except that
+ * once one connection is ready, it keeps accepting (without
+ * blocking) until the listen backlog is empty or 'max'
+ * descriptors have been stored in 'fds'. It returns the number
+ * of descriptors accepted, or -1 on error with errno set.
+ *
+ * ioctx_accept_spawn() accepts up to 'max' (at most 64)
+ * connections the same way, and starts a task running
+ * 'start' for each one, with the descriptor in the 'fd'
+ * member of its argument. The tasks are allocated up front
+ * rather than through spawn()'s deferred allocation, so a
+ * burst of connections costs one wakeup of the acceptor.
+ * It returns the number of tasks started, or -1 on error.
+ *
+ * Descriptors are only registered with the poller the first
+ * time an operation on them would block, so short-lived
+ * connections whose requests are already waiting when they
+ * are accepted never cost a poller syscall.
+ */
+int ioctx_accept_n(ioctx_t *ctx, int *fds, int max);
+int ioctx_accept_spawn(ioctx_t *ctx, int max, void (*start)(word_t));
+
+/*
+ * ioctx_shed() marks a listener so that ioctx_accept() and
+ * friends shed load while the runtime is overloaded (see
+ * overload_control()): with SHED_PAUSE, they stop accepting
+ * (the kernel's backlog holds or refuses new connections),
+ * and with SHED_CLOSE, they accept and immediately close new
+ * connections. SHED_NONE (the default) keeps accepting.
+ */
+#define SHED_NONE  0
+#define SHED_PAUSE 1
+#define SHED_CLOSE 2
+void ioctx_shed(ioctx_t *ctx, int mode);
+
+/*
+ * ioctx_listen() creates a non-blocking stream socket
+ * bound to 'addr' with SO_REUSEADDR and SO_REUSEPORT set,
+ * calls listen(), and initializes 'ctx' with it. Every
+ * thread can create its own listener on the same address,
+ * and the kernel will spread incoming connections across them.
+ * On success, 0 is returned. On error, -1 is returned, and
+ * errno will be set.
+ */
+int ioctx_listen(ioctx_t *ctx, const struct sockaddr *addr, socklen_t addrlen, int backlog);
+
+/*
+ * ioctx_connect() creates a non-blocking stream socket,
+ * initializes 'ctx' with it, and connects it to 'addr'.
+ * If the connection can't be established immediately,
+ * the scheduler is invoked until it succeeds or fails.
+ * On success, 0 is returned. On error, -1 is returned,
+ * errno is set (for instance, to ECONNREFUSED), and
+ * the socket is closed.
+ */
+int ioctx_connect(ioctx_t *ctx, const struct sockaddr *addr, socklen_t addrlen);
+
+/*
+ * A dgram_t describes one datagram for ioctx_recv_dgrams()
+ * and ioctx_send_dgrams().
+ */
+typedef struct {
+	char      *buf;     /* data */
+	size_t    cap;      /* size of 'buf' (recv) */
+	size_t    len;      /* bytes of data (set by recv; read by send) */
+	struct sockaddr_storage addr; /* source (recv) or destination (send) */
+	socklen_t addrlen;  /* 0 to send on a connected socket */
+	int       flags;    /* msg_flags from the receive (e.g. MSG_TRUNC) */
+	size_t    segsize;  /* segment size for UDP GSO/GRO, or 0 */
+} dgram_t;
+
+/*
+ * ioctx_recv_dgrams() receives up to 'n' datagrams into 'msgs',
+ * and returns the number received, blocking only until there is
+ * at least one. On error, -1 is returned and errno is set. A
+ * message whose 'buf' is NULL takes a 'cap'-byte buffer from
+ * the iobuf pool, which the caller must iobuf_put(); slots that
+ * aren't filled get their buffers back and 'buf' reset to NULL.
+ *
+ * ioctx_send_dgrams() sends the 'n' datagrams in 'msgs',
+ * blocking as necessary, and returns the number sent. If an
+ * error occurs after some datagrams have been sent, their count
+ * is returned, and otherwise -1.
+ *
+ * Both move batches of datagrams per syscall where the operating
+ * system allows it (recvmmsg/sendmmsg on Linux). On Linux, a
+ * datagram sent with a non-zero 'segsize' is split into
+ * 'segsize'-byte datagrams by the kernel (UDP_SEGMENT), and after
+ * ioctx_udp_gro() has been called, received datagrams from the
+ * same flow may be coalesced into one message, with 'segsize'
+ * giving the size of the individual datagrams. Elsewhere,
+ * ioctx_udp_gro() fails with ENOPROTOOPT, and sending with
+ * 'segsize' fails with EOPNOTSUPP.
+ */
+int ioctx_recv_dgrams(ioctx_t *ctx, dgram_t *msgs, int n);
+int ioctx_send_dgrams(ioctx_t *ctx, dgram_t *msgs, int n);
+int ioctx_udp_gro(ioctx_t *ctx);
+
+/*
+ * An upstream_t tracks the connections to one peer
+ * address in a connpool_t. Users should treat the
+ * contents of both as opaque.
+ */
+typedef struct {
+	struct sockaddr_storage addr;
+	socklen_t  addrlen;    /* 0 if unused */
+	uint64_t   used;       /* slots holding a connection */
+	uint64_t   idle;       /* slots holding an idle connection */
+	int        connecting; /* connects in progress */
+	int        woken;      /* waiters woken but not yet running */
+	tasklist_t waiters;
+} upstream_t;
+
+typedef struct {
+	upstream_t *ups;
+	ioctx_t    *conns;
+	int        nups;
+	int        per;
+	int        max_connecting;
+} connpool_t;
+
+/*
+ * connpool_init() initializes a pool of outbound connections
+ * to as many as 'nups' distinct peers, using the array 'ups'.
+ * Each peer gets 'per' (at most 64) slots from 'conns', which
+ * must have room for nups*per connections, and at most
+ * 'max_connecting' connects to a peer are in flight at once.
+ *
+ * connpool_get() returns a connection to 'addr', preferring an
+ * idle one that is still open. Otherwise it connects, if the
+ * peer has a free slot and isn't at its connect limit, or waits
+ * in line for a connection to be returned. On error (for
+ * instance, if the connect fails, or the pool already
+ * tracks 'nups' other peers, ENOSPC), NULL is returned
+ * and errno is set.
+ *
+ * connpool_put() returns a connection to its pool, and hands
+ * it to the next waiting task, if any. If 'reuse' is zero (say,
+ * after an I/O error, or if the peer may have more to send),
+ * the connection is closed instead. A corked connection
+ * is flushed and uncorked first.
+ */
+void connpool_init(connpool_t *pool, upstream_t *ups, int nups, ioctx_t *conns, int per, int max_connecting);
+ioctx_t *connpool_get(connpool_t *pool, const struct sockaddr *addr, socklen_t addrlen);
+void connpool_put(connpool_t *pool, ioctx_t *conn, int reuse);
+
 /*
  * ioctx_cancel() causes any tasks blocked on I/O on the
  * given ioctx to be woken up with errno set to ECANCELED.
@@ -181,4 +796,59 @@ int ioctx_accept(ioctx_t *ctx, struct sockaddr *addr, socklen_t *addrlen);
  */
 void ioctx_cancel(ioctx_t *ctx);
 
+/*
+ * chip_offload() runs fn(arg) on one of a small pool of
+ * worker threads, and parks the calling task until it
+ * returns. Use it for calls that would otherwise block
+ * the scheduler (regular-file I/O, fsync(), getaddrinfo(),
+ * open(), etc.) fn runs on a thread with a full-size stack,
+ * but it must not call into the chip runtime. The worker
+ * threads are started on first use. On success, 0 is returned.
+ * If no worker threads could be started, -1 is returned and
+ * errno is set.
+ */
+int chip_offload(void (fn)(word_t), word_t arg);
+
+/*
+ * ioctx_pread() and ioctx_pwrite() are analagous
+ * to pread(2) and pwrite(2), except that they
+ * run on the chip_offload() pool, so they never
+ * block the scheduler. They are retried on EINTR.
+ */
+ssize_t ioctx_pread(ioctx_t *ctx, char *buf, size_t bytes, off_t off);
+ssize_t ioctx_pwrite(ioctx_t *ctx, char *buf, size_t bytes, off_t off);
+
+/*
+ * chip_log() appends a record to the calling thread's log
+ * ring, using very little stack: the arguments are copied,
+ * and formatting is deferred to a task that writes records
+ * out in batches. 'fmt' supports a subset of printf(): %d,
+ * %i, %u, %x (with l, ll, or z), %c, %s, %p and %%, without
+ * flags or widths. 'fmt' itself is not copied, so it must
+ * outlive the record (use a string literal); %s strings are
+ * copied, but may be truncated, since each record has room
+ * for about 100 bytes of arguments. Each record is one line.
+ * chip_log_bytes() appends up to that many bytes of already
+ * formatted (or binary) data, which are written as-is.
+ *
+ * If the ring is full (because the output can't keep up),
+ * records are dropped, and the number dropped is written to
+ * the log when there's room again; chip_log_dropped() returns
+ * the running total. Both functions do nothing unless logging
+ * has been started with chip_log_open().
+ *
+ * chip_log_open() starts a task that writes the log to 'out'
+ * with ioctx_write(). On success, 0 is returned. On error, -1
+ * is returned, and errno will be set. chip_log_flush() blocks
+ * until everything logged so far has been written (or failed
+ * to write). chip_log_close() flushes and stops the task, after
+ * which 'out' may be destroyed.
+ */
+void chip_log(const char *fmt, ...) __attribute__((format(printf, 1, 2)));
+void chip_log_bytes(const void *buf, size_t len);
+uint64_t chip_log_dropped(void);
+int chip_log_open(ioctx_t *out);
+void chip_log_flush(void);
+void chip_log_close(void);
+
 #endif /* __CHIP_RUNTIME_H_ */
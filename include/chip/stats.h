@@ -0,0 +1,43 @@
+#ifndef __CHIP_STATS_H_
+#define __CHIP_STATS_H_
+#include <stdint.h>
+#include <stdatomic.h>
+
+/*
+ * The layout of the live statistics segment that
+ * chip_stats_publish() shares at /dev/shm/chip-<pid>
+ * (shm_open() name "/chip-<pid>"), for tools like chiptop.
+ *
+ * Each thread that publishes owns one slot, and is its only
+ * writer. Slots are guarded by a sequence lock: 'seq' is odd
+ * while the owner is updating the slot, so a reader copies
+ * the slot and retries if 'seq' was odd or changed meanwhile.
+ */
+#define CHIP_STATS_MAGIC   0x63686970 /* "chip" */
+#define CHIP_STATS_VERSION 1
+#define CHIP_STATS_THREADS 64
+
+typedef struct {
+	atomic_uint seq;
+	int32_t     runnable;  /* tasks in the run queue */
+	int32_t     parked;    /* tasks parked on tasklists */
+	int32_t     iowait;    /* tasks waiting for I/O or offloaded calls */
+	int32_t     live;      /* tasks allocated */
+	int32_t     highwater; /* most tasks ever allocated at once */
+	uint64_t    mapped;    /* bytes mapped for the task heap */
+	uint64_t    switches;  /* context switches */
+	uint64_t    polls;     /* poller syscalls */
+	uint64_t    iocalls;   /* I/O syscalls made by ioctx_XXX calls */
+	uint64_t    exits;     /* tasks that have exited */
+	int64_t     updated;   /* CLOCK_MONOTONIC ns of this update */
+} chip_stats_thread_t;
+
+typedef struct {
+	uint32_t            magic;
+	uint32_t            version;
+	int32_t             pid;
+	atomic_int          nthreads; /* slots in use */
+	chip_stats_thread_t threads[CHIP_STATS_THREADS];
+} chip_stats_seg_t;
+
+#endif
@@ -2,14 +2,35 @@
 #include <stdint.h>
 #include <stddef.h>
 #include <sys/socket.h>
+#include <sys/uio.h>
 #include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/time.h>
 #include <signal.h>
 #include <limits.h>
 #include <unistd.h>
 #include <stdio.h>
+#include <stdarg.h>
+#include <stdlib.h>
+#include <string.h>
 #include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <time.h>
+#include <netinet/in.h>
+#ifdef __linux__
+#include <netinet/udp.h>
+#ifndef UDP_SEGMENT
+#define UDP_SEGMENT 103
+#endif
+#ifndef UDP_GRO
+#define UDP_GRO 104
+#endif
+#endif
 
 #include <chip/runtime.h>
+#include <chip/stats.h>
 
 /* run-of-the-mill gcc grossness */
 #define unlikely(expr) __builtin_expect(!!(expr), 0)
@@ -32,9 +53,53 @@ static void  __panicstr(const char *msg, size_t len) {
 
 /* --- OS-specific declarations --- */
 
-static void poll(int ms);
+/* returns the number of tasks made runnable */
+static int poll(int ms);
 static void pollinit(void);
 
+/* 
+   wakeup() may be called from any thread to interrupt
+   poll() in the thread whose wakeup_init() returned 'handle'
+ */
+static int wakeup_init(void);
+static void wakeup(int handle);
+
+/* called by poll() after a wakeup(); returns # of tasks woken */
+static int handle_wakeup(void);
+
+/* non-blocking flush of buffered writes; records errors in the cork */
+static void cork_flush(iocork_t *c);
+
+/* flush what we can and detach the cork from an ioctx being destroyed */
+static void cork_drop(ioctx_t *ctx);
+
+/* stop tracking an ioctx that is being destroyed */
+static void ioctx_untrack(ioctx_t *ctx);
+
+/* flush the running task's corks; called before it blocks */
+static void flush_corks(void);
+
+/* 
+   register an ioctx with the poller; this is done lazily, the
+   first time an operation on it would block, so connections
+   that never block never cost a poller syscall
+ */
+static int ioctx_arm(ioctx_t *ctx);
+
+/* accept(2) a non-blocking, close-on-exec connection */
+static int accept_nb(int fd, struct sockaddr *addr, socklen_t *addrlen);
+
+static int park_and_iowait(ioctx_t *ctx, tasklist_t *waiters);
+
+/* wake the first task waiting on an ioctx; returns # of tasks woken */
+static int io_wake(tasklist_t *waiters);
+
+/* ioctx_t flags */
+#define IOCTX_NOPOLL 1 /* can't be registered with the poller (e.g. a regular file) */
+#define IOCTX_ARMED  2 /* registered with the poller */
+#define IOCTX_SHED_PAUSE 4 /* see ioctx_shed() */
+#define IOCTX_SHED_CLOSE 8
+
 
 #include "runtime_poller.h"
 
@@ -42,10 +107,17 @@ static void pollinit(void);
 
 typedef struct regctx_s regctx_t;
 
+/* a cheap clock for statistics (see get_sched_stats()); the units are up to the architecture */
+static inline uint64_t ticks(void);
+static inline void uctx_regs(const void *uctx, uintptr_t *pc, uintptr_t *sp, uintptr_t *fp);
 static inline word_t get_arg0(char *stack);
-static inline void setup(regctx_t *ctx, char *stack, void (*retpc)(void), word_t arg0);
+static inline void *get_reserve(char *stack, size_t reserve);
+static inline void setup(regctx_t *ctx, char *stack, size_t reserve, void (*retpc)(void), word_t arg0);
 static void _swapctx(regctx_t *save, const regctx_t *load);
 
+/* like memchr() */
+static const char *scan_byte(const char *p, size_t n, char c);
+
 __attribute__((noreturn))
 static void _loadctx(const regctx_t *load);
 
@@ -70,20 +142,124 @@ struct task_s {
 	void       (*start)(word_t); 
 	char       *stack;
 	arena_t    *arena;
+	iocork_t   *dirty;  /* corks to flush before blocking */
+	uint64_t   readyts; /* ticks() when last made runnable */
+	uint64_t   born;    /* ticks() when started */
+	group_t    *group;  /* see group_spawn() */
+	int        slot;    /* in group->results */
 };
 
-/* the global run queue/state */
-static struct{
+/* the per-thread run queue/state */
+static _Thread_local struct{
 	task_t     *running;
 	tasklist_t queue;    /* runnable */
+	int        qlen;     /* tasks in queue */
 	int        parked;   /* # of parked tasks */
 	int        iowait;   /* # of tasks waiting for i/o */
 	tasklist_t begin;    /* blocking requests to newtask() */
+	int        budget;   /* live tasks spawn() may allocate eagerly */
+	int        credit;   /* switches until the poll budget is checked */
+	int        step;     /* credit granted per check */
+	int        since;    /* switches since the last poll */
+	int        poll_every; /* see poll_budget() */
+	int        io_first;
+	int64_t    poll_nsec;
+	int64_t    last_poll;  /* CLOCK_MONOTONIC, if poll_nsec is set */
 	task_t     t0;       /* the root task (taskmain()) */
 	uintptr_t  t0_magic; /* t0->stack points here */
 } runq;
 
+/* 
+   Scheduler histograms (see get_sched_stats()). The
+   time-valued ones are kept in ticks(), and converted
+   to nanoseconds when they are read. They are only kept
+   once something asks for them (see sched_stats_start()),
+   so that other programs don't read the clock on every
+   switch; a task made runnable before then has a zero
+   timestamp and isn't counted.
+ */
+static _Thread_local struct {
+	hist_t   delay;   /* ticks spent runnable before running */
+	hist_t   events;  /* tasks woken per poll */
+	hist_t   block;   /* ticks spent in blocking polls */
+	hist_t   qlen;    /* run queue length at each poll */
+	hist_t   life;    /* ticks from start to exit */
+	uint64_t iocalls; /* syscalls made by ioctx_XXX() */
+	uint64_t switches; /* always counted, unlike delay.count */
+	uint64_t exits;
+	uint64_t ticks0;  /* calibration point */
+	int64_t  nsec0;
+	int      timed;   /* keep the time-valued histograms */
+} metrics;
+
+static int64_t now_nsec(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (int64_t)ts.tv_sec*1000000000 + ts.tv_nsec;
+}
+
+/* nanoseconds per ticks(), measured since chip_init() */
+static double nsec_per_tick(void) {
+	uint64_t dt = ticks() - metrics.ticks0;
+	int64_t dns = now_nsec() - metrics.nsec0;
+	return (dt > 0 && dns > 0) ? (double)dns / (double)dt : 1.0;
+}
+
+/* a timestamp for readyts and born; 0 unless timing is on */
+static inline uint64_t stamp(void) {
+	return unlikely(metrics.timed) ? ticks() : 0;
+}
+
+static inline void hist_add(hist_t *h, uint64_t v) {
+	int i = v ? 64 - __builtin_clzll(v) : 0;
+	h->count++;
+	h->sum += v;
+	h->buckets[(i < HIST_BUCKETS) ? i : HIST_BUCKETS-1]++;
+}
+
+/* 
+   The live statistics segment (see chip/stats.h) is shared
+   by every thread of the process; each publishing thread
+   updates its own slot every STATS_EVERY switches and after
+   every poll.
+ */
+#define STATS_EVERY 4096
+
+static struct {
+	pthread_mutex_t  lock;
+	chip_stats_seg_t *seg;
+	char             name[32];
+} shstats = { PTHREAD_MUTEX_INITIALIZER, NULL, "" };
+
+static _Thread_local chip_stats_thread_t *stats_slot;
+
+static void stats_update(void);
+
+typedef struct offload_job_s offload_job_t;
+typedef struct mailbox_s mailbox_t;
+
+/* the parts of this thread's runtime that other threads touch */
+struct chip_rt_s {
+	int                      wake;    /* wakeup() handle, or -1 */
+	atomic_int               pending; /* wakeup() already sent */
+	_Atomic(offload_job_t *) done;    /* finished offload jobs */
+	mailbox_t                *mail;   /* see chip_self() */
+
+	/* see chip_watchdog(); only the owner writes the first three */
+	int                      dog;     /* watchdog enabled */
+	atomic_ulong             epoch;   /* bumped on every switch */
+	_Atomic(uintptr_t)       current; /* running task's start function */
+	atomic_int               idle;    /* blocked in the poller */
+	atomic_int               preempt; /* see chip_maybe_yield() */
+	atomic_int               dog_ms;  /* threshold; 0 to stop, -1 if no thread */
+	pthread_t                dogtid;  /* the watchdog, unless dog_ms is -1 */
+};
+
+static _Thread_local chip_rt_t rt;
+
+#ifndef STACK_SIZE
 #define STACK_SIZE 12288 /* three pages */
+#endif
 #define ARENA_TASKS (sizeof(uintptr_t)*8)
 #define ARENA_STACK_MAPPING (ARENA_TASKS*STACK_SIZE)
 /* all the stacks, plus the arena structure itself */
@@ -184,13 +360,21 @@ static void arena_put_task(task_t *task) {
 }
 
 /* The task heap. */
-static struct {
+static _Thread_local struct {
 	arena_t *empty;
 	arena_t *partial;
 	arena_t *full;
 	int     alloc;
+	int     used;      /* tasks handed out by new_task() */
+	int     highwater; /* max(used) */
+	int     limit;     /* cap on used, or 0 */
+	unsigned long denied; /* spawns held back by the limit */
 } theap;
 
+static inline int heap_at_limit(void) {
+	return theap.limit && theap.used >= theap.limit;
+}
+
 static int arena_is_full(arena_t *arena) {
 	return (arena->bits == ~((uintptr_t)0));
 }
@@ -237,7 +421,8 @@ static task_t *new_task(void) {
 		if (theap.empty) {
 			moving = theap.empty;
 			theap.empty = moving->next;
-			theap.empty->prev = NULL;
+			if (theap.empty)
+				theap.empty->prev = NULL;
 		} else {
 			moving = map_arena();
 			if (moving == NULL)
@@ -256,6 +441,8 @@ static task_t *new_task(void) {
 
 	/* may as well fault the stack now */
 	push_magic(out);
+	if (++theap.used > theap.highwater)
+		theap.highwater = theap.used;
 	return out;
 }
 
@@ -281,6 +468,7 @@ static void arena_unlink(arena_t **head, arena_t *arena) {
 /* release a task back to the heap */
 static void free_task(task_t *task) {
 	BUG_ON(task->status != STATUS_EMPTY);
+	--theap.used;
 	arena_t *arena = task->arena;
 	int was_full = arena_is_full(arena);
 	arena_put_task(task);
@@ -367,6 +555,122 @@ void get_tsk_stats(tsk_stats_t *stats) {
 	BUG_ON(stats->iowait != runq.iowait);
 }
 
+void get_heap_stats(heap_stats_t *stats) {
+	stats->live = theap.used;
+	stats->highwater = theap.highwater;
+	stats->limit = theap.limit;
+	stats->denied = theap.denied;
+	stats->mapped = (size_t)(theap.alloc/ARENA_TASKS) * ARENA_MAPPING;
+}
+
+/* convert a histogram of ticks() to nanoseconds */
+static void hist_to_nsec(hist_t *out, const hist_t *in, double nsec_per_tick) {
+	memset(out, 0, sizeof(*out));
+	out->count = in->count;
+	out->sum = (uint64_t)(in->sum * nsec_per_tick);
+	out->buckets[0] = in->buckets[0];
+	for (int i=1; i<HIST_BUCKETS; ++i) {
+		if (in->buckets[i] == 0)
+			continue;
+
+		/* move the bucket by the value at its (geometric) middle */
+		uint64_t mid = (uint64_t)(1.5 * (double)((uint64_t)1<<(i-1)) * nsec_per_tick);
+		int j = mid ? 64 - __builtin_clzll(mid) : 0;
+		out->buckets[(j < HIST_BUCKETS) ? j : HIST_BUCKETS-1] += in->buckets[i];
+	}
+}
+
+void sched_stats_start(void) {
+	metrics.timed = 1;
+}
+
+void get_sched_stats(sched_stats_t *stats) {
+	double scale = nsec_per_tick();
+
+	hist_to_nsec(&stats->runq_delay, &metrics.delay, scale);
+	hist_to_nsec(&stats->poll_block, &metrics.block, scale);
+	hist_to_nsec(&stats->lifetime, &metrics.life, scale);
+	stats->poll_events = metrics.events;
+	stats->runq_len = metrics.qlen;
+}
+
+static void stats_update(void) {
+	chip_stats_thread_t *t = stats_slot;
+	unsigned seq = atomic_load_explicit(&t->seq, memory_order_relaxed);
+
+	atomic_store_explicit(&t->seq, seq+1, memory_order_relaxed);
+	atomic_thread_fence(memory_order_release);
+	t->runnable = runq.qlen;
+	t->parked = runq.parked;
+	t->iowait = runq.iowait;
+	t->live = theap.used;
+	t->highwater = theap.highwater;
+	t->mapped = (uint64_t)(theap.alloc/ARENA_TASKS) * ARENA_MAPPING;
+	t->switches = metrics.switches;
+	t->polls = metrics.events.count;
+	t->iocalls = metrics.iocalls;
+	t->exits = metrics.exits;
+	t->updated = now_nsec();
+	atomic_store_explicit(&t->seq, seq+2, memory_order_release);
+}
+
+static void stats_unlink(void) {
+	shm_unlink(shstats.name);
+}
+
+static chip_stats_seg_t *stats_map(void) {
+	int fd;
+	void *mem;
+
+	snprintf(shstats.name, sizeof(shstats.name), "/chip-%d", (int)getpid());
+	fd = shm_open(shstats.name, O_RDWR|O_CREAT|O_TRUNC|O_CLOEXEC, 0600);
+	if (fd == -1)
+		return NULL;
+	if (ftruncate(fd, sizeof(chip_stats_seg_t)) == -1) {
+		int err = errno;
+		close(fd);
+		shm_unlink(shstats.name);
+		errno = err;
+		return NULL;
+	}
+	mem = mmap(NULL, sizeof(chip_stats_seg_t), PROT_READ|PROT_WRITE, MAP_SHARED, fd, 0);
+	close(fd);
+	if (mem == MAP_FAILED) {
+		shm_unlink(shstats.name);
+		return NULL;
+	}
+
+	chip_stats_seg_t *seg = mem;
+	seg->magic = CHIP_STATS_MAGIC;
+	seg->version = CHIP_STATS_VERSION;
+	seg->pid = getpid();
+	atexit(stats_unlink);
+	return seg;
+}
+
+int chip_stats_publish(void) {
+	if (stats_slot != NULL)
+		return 0;
+
+	pthread_mutex_lock(&shstats.lock);
+	if (shstats.seg == NULL && (shstats.seg = stats_map()) == NULL) {
+		pthread_mutex_unlock(&shstats.lock);
+		return -1;
+	}
+	int n = atomic_load(&shstats.seg->nthreads);
+	if (n == CHIP_STATS_THREADS) {
+		pthread_mutex_unlock(&shstats.lock);
+		errno = ENOSPC;
+		return -1;
+	}
+	stats_slot = &shstats.seg->threads[n];
+	atomic_store(&shstats.seg->nthreads, n+1);
+	pthread_mutex_unlock(&shstats.lock);
+
+	stats_update();
+	return 0;
+}
+
 static task_t *list_pop(tasklist_t *tl) {
 	if (tl->top == NULL)
 		return NULL;
@@ -400,24 +704,214 @@ static task_t *task_handoff(task_t *next) {
 	task_t *work = list_pop(&runq.begin);
 	work->next = next;
 	work->status = STATUS_RUNNABLE;
+	work->readyts = stamp();
 	--runq.parked;
 	return work;
 }
 
+/* 
+   Left alone, find_work() only polls once the run queue is
+   empty, which amortizes the cost of polling, but starves I/O
+   for as long as tasks keep yielding to one another. So every
+   so often (see poll_budget()) we also poll without blocking,
+   as long as there's anything to poll for.
+ */
+#define POLL_EVERY       1024 /* default switches between polls */
+#define POLL_CLOCK_EVERY 16   /* switches between clock reads */
+
+static void poll_now(int ms) {
+	task_t *tail = runq.queue.tail;
+	int woke;
+	hist_add(&metrics.qlen, runq.qlen);
+	if (ms != 0) {
+		uint64_t start = stamp();
+		if (rt.dog)
+			atomic_store_explicit(&rt.idle, 1, memory_order_relaxed);
+		woke = poll(ms);
+		if (rt.dog)
+			atomic_store_explicit(&rt.idle, 0, memory_order_relaxed);
+		if (start)
+			hist_add(&metrics.block, ticks() - start);
+	} else {
+		woke = poll(ms);
+	}
+	hist_add(&metrics.events, woke);
+	if (stats_slot != NULL)
+		stats_update();
+	runq.since = 0;
+	if (runq.poll_nsec)
+		runq.last_poll = now_nsec();
+	
+	/* move the newly-runnable tasks from the back of the queue to the front */
+	if (runq.io_first && tail != NULL && tail != runq.queue.tail) {
+		runq.queue.tail->next = runq.queue.top;
+		runq.queue.top = tail->next;
+		runq.queue.tail = tail;
+		tail->next = NULL;
+	}
+}
+
+static void poll_check(void) {
+	runq.credit = runq.step;
+	if (runq.iowait == 0 && rt.mail == NULL) {
+		runq.since = 0;
+		return;
+	}
+	if (runq.poll_every)
+		runq.since += runq.step;
+	
+	if ((runq.poll_every && runq.since >= runq.poll_every) ||
+	    (runq.poll_nsec && now_nsec() - runq.last_poll >= runq.poll_nsec))
+		poll_now(0);
+}
+
+void poll_budget(int switches, int usec, int io_first) {
+	runq.poll_every = switches;
+	runq.poll_nsec = (int64_t)usec * 1000;
+	runq.io_first = io_first;
+	runq.step = (switches > 0) ? switches : INT_MAX;
+	if (usec > 0 && runq.step > POLL_CLOCK_EVERY) {
+		runq.step = POLL_CLOCK_EVERY;
+		runq.last_poll = now_nsec();
+	}
+	runq.credit = runq.step;
+	runq.since = 0;
+}
+
+/*
+   The overload controller (see overload_control()) is
+   CoDel applied to the run queue: every switch samples
+   the time the next task spent runnable, and if even the
+   smallest sample in an interval exceeds the target, the
+   queue is a standing one and we are overloaded. That
+   lasts until a sample comes in under the target or the
+   queue drains.
+ */
+/* an acceptor paused by SHED_PAUSE; lives on its stack */
+typedef struct pauser_s pauser_t;
+
+struct pauser_s {
+	ioctx_t    *ctx;
+	tasklist_t waiting; /* the acceptor, in iowait */
+	pauser_t   *next;
+};
+
+static _Thread_local struct {
+	uint64_t   target;   /* ticks; zero if disabled */
+	uint64_t   interval; /* ticks */
+	uint64_t   start;    /* of this interval */
+	uint64_t   min;      /* smallest delay this interval */
+	int        overloaded;
+	pauser_t   *paused;  /* acceptors waiting for the overload to end */
+} codel;
+
+static int io_wake(tasklist_t *waiters);
+
+static void codel_clear(void) {
+	codel.overloaded = 0;
+	for (pauser_t *p = codel.paused; p; p = p->next)
+		io_wake(&p->waiting);
+}
+
+static void codel_sample(uint64_t now, uint64_t delay) {
+	if (delay < codel.min)
+		codel.min = delay;
+	if (unlikely(codel.overloaded) && delay < codel.target)
+		codel_clear();
+	if (now - codel.start >= codel.interval) {
+		if (codel.min > codel.target)
+			codel.overloaded = 1;
+		codel.min = UINT64_MAX;
+		codel.start = now;
+	}
+}
+
+void overload_control(int target_usec, int interval_ms) {
+	if (target_usec <= 0 || interval_ms <= 0) {
+		codel.target = 0;
+		codel_clear();
+		return;
+	}
+	sched_stats_start(); /* for the run queue sojourn times */
+	double per_usec = 1000.0 / nsec_per_tick();
+	codel.target = (uint64_t)(target_usec * per_usec);
+	codel.interval = (uint64_t)((uint64_t)interval_ms * 1000 * per_usec);
+	codel.start = ticks();
+	codel.min = UINT64_MAX;
+}
+
+int chip_overloaded(void) {
+	return codel.overloaded;
+}
+
+void ioctx_shed(ioctx_t *ctx, int mode) {
+	ctx->flags &= ~(IOCTX_SHED_PAUSE|IOCTX_SHED_CLOSE);
+	if (mode == SHED_PAUSE)
+		ctx->flags |= IOCTX_SHED_PAUSE;
+	else if (mode == SHED_CLOSE)
+		ctx->flags |= IOCTX_SHED_CLOSE;
+}
+
+/*
+   Paused acceptors wait as if for I/O, so that ioctx_cancel()
+   (and so ioctx_destroy()) can cancel them like any other.
+   Returns -1 with ECANCELED if that happens, without touching
+   'ctx' again.
+ */
+static int shed_pause(ioctx_t *ctx) {
+	pauser_t p;
+	int res = 0;
+
+	p.ctx = ctx;
+	p.waiting.top = p.waiting.tail = NULL;
+	p.next = codel.paused;
+	codel.paused = &p;
+	while (codel.overloaded && (ctx->flags&IOCTX_SHED_PAUSE)) {
+		if ((res = park_and_iowait(ctx, &p.waiting)) < 0)
+			break;
+	}
+
+	pauser_t **pp = &codel.paused;
+	while (*pp != &p)
+		pp = &(*pp)->next;
+	*pp = p.next;
+	return res;
+}
+
+/* closes an accepted connection if we're shedding it */
+static int shed_close(ioctx_t *ctx, int fd) {
+	if (!codel.overloaded || !(ctx->flags&IOCTX_SHED_CLOSE))
+		return 0;
+	while (close(fd) == -1 && errno == EINTR) ;
+	return 1;
+}
+
 static task_t *find_work(int must) {
+	if (unlikely(--runq.credit <= 0))
+		poll_check();
+
 	task_t *work = list_pop(&runq.queue);
-	if (work == NULL) {
-		if (runq.begin.top) {
+	if (unlikely(work == NULL) && unlikely(codel.overloaded)) {
+		/* there's no queue left to speak of */
+		codel_clear();
+		work = list_pop(&runq.queue);
+	}
+	if (work != NULL) {
+		--runq.qlen;
+	} else {
+		if (runq.begin.top && !heap_at_limit()) {
 			/* now we've proven we need to allocate */
 			work = task_handoff(new_task());
 		} else if (must) {
-			if (unlikely(runq.iowait == 0))
+			/* with a mailbox, another thread may have work for us */
+			if (unlikely(runq.iowait == 0 && rt.mail == NULL))
 				panic("deadlock");
 
-		        poll(-1); /* TODO: timers */
+			poll_now(-1); /* TODO: timers */
 			work = list_pop(&runq.queue);
 			if (unlikely(work == NULL))
 				panic("deadlock");
+			--runq.qlen;
 
 		}
 	}
@@ -431,12 +925,55 @@ static inline void smashing_check(task_t *task) {
 
 }
 
+#define SYSTEM_STACK_SIZE (1024*1024)
+
+/* the stack borrowed by chip_call_on_system_stack() */
+static _Thread_local struct {
+	char     *top;
+	task_t   *caller; /* task running on the stack, if any */
+	regctx_t ctx;     /* entry point on the system stack */
+	regctx_t ret;     /* caller's saved context */
+	void     (*fn)(word_t);
+	word_t   arg;
+} sysstack;
+
+/* catch blocking calls before they poll or allocate on our behalf */
+static inline void sysstack_check(void) {
+	if (unlikely(sysstack.caller != NULL))
+		panic("task blocked on the system stack");
+}
+
+/* tell the watchdog that 'task' is about to run */
+static void dog_tick(task_t *task) {
+	word_t start;
+	start.fnptr = (void (*)(void))task->start;
+	atomic_store_explicit(&rt.current, start.val, memory_order_relaxed);
+	atomic_store_explicit(&rt.preempt, 0, memory_order_relaxed);
+	atomic_store_explicit(&rt.epoch, atomic_load_explicit(&rt.epoch, memory_order_relaxed)+1, memory_order_relaxed);
+}
+
 /* to de-schedule, set runq.running->status, then call swtch(find_work(1)) */
 static void swtch(task_t *next) {
+	sysstack_check();
+
 	/*
 	 * unlikely but possible: the task that runs the poller
 	 * is the first one to be available.
 	 */
+	if (unlikely(rt.dog))
+		dog_tick(next);
+
+	if (unlikely(metrics.timed)) {
+		/* one clock read serves both tasks when we yield with sched() */
+		uint64_t now = ticks();
+		if (next->readyts != 0) {
+			hist_add(&metrics.delay, now - next->readyts);
+			if (unlikely(codel.target != 0))
+				codel_sample(now, now - next->readyts);
+		}
+		if (runq.running->status == STATUS_RUNNABLE)
+			runq.running->readyts = now;
+	}
 	if (unlikely(next == runq.running)) {
 		runq.running->status = STATUS_RUNNING;
 		return;
@@ -444,6 +981,8 @@ static void swtch(task_t *next) {
 	
 	BUG_ON(next->status != STATUS_RUNNABLE);
 	smashing_check(next);
+	if (unlikely((++metrics.switches&(STATS_EVERY-1)) == 0) && stats_slot != NULL)
+		stats_update();
 	next->status = STATUS_RUNNING;
 	task_t *me = runq.running;
 	runq.running = next;
@@ -451,32 +990,83 @@ static void swtch(task_t *next) {
 	return;
 }
 
-static int yield(int block, tasklist_t *target) {
-	task_t *next = find_work(block);
-	if (next == NULL) 
-		return 0;
-
-	list_pushback(target, runq.running);
+void sched(void) {
+	sysstack_check();
+	task_t *next = find_work(0);
+	if (next == NULL)
+		return;
+	if (unlikely(runq.running->dirty != NULL))
+		flush_corks();
+	
+	runq.running->status = STATUS_RUNNABLE;
+	list_pushback(&runq.queue, runq.running);
+	++runq.qlen;
 	swtch(next);
-	return 1;
 }
 
-void sched(void) {
-	runq.running->status = STATUS_RUNNABLE;
-	if (yield(0, &runq.queue) == 0)
-		runq.running->status = STATUS_RUNNING;
+/* 
+   Calls queued with spawn_inline() are run back-to-back 
+   on one task's stack. If one of them blocks, the task that
+   was running it is left to finish that call as an ordinary
+   task, and a fresh runner picks up the rest of the queue.
+   Runners are ordinary tasks, so they count against the
+   task limit; at the limit, queued calls wait until a task
+   exits (or a blocked runner returns and takes over again).
+   A runner exits once the queue is empty, rather than staying
+   parked.
+ */
+#define DEFER_CHUNK 1023
+#define DEFER_BATCH 64 /* calls between yields */
+
+typedef struct defer_chunk_s defer_chunk_t;
+
+struct defer_chunk_s {
+	defer_chunk_t *next;
+	int           head; /* next call to run */
+	int           tail; /* next free slot */
+	struct {
+		void   (*fn)(word_t);
+		word_t arg;
+	} calls[DEFER_CHUNK];
+};
+
+static _Thread_local struct {
+	defer_chunk_t *head;    /* oldest pending calls */
+	defer_chunk_t *tail;    /* newest pending calls */
+	defer_chunk_t *spare;   /* empty chunks */
+	task_t        *runner;  /* the task draining the queue */
+	task_t        *calling; /* the runner, while inside a call */
+} defer;
+
+static void defer_detach(void);
+static int start_runner(void);
+
+/* queued calls with nobody to run them */
+static inline int defer_stranded(void) {
+	return defer.runner == NULL && defer.head && defer.head->head != defer.head->tail;
 }
 
 /* park task on tasklist; deschedule */
 void wait(tasklist_t *tl) {
+	sysstack_check();
+	if (unlikely(defer.calling == runq.running))
+		defer_detach();
+	if (unlikely(runq.running->dirty != NULL))
+		flush_corks();
+
 	runq.running->status = STATUS_PARKED;
 	++runq.parked;
-	yield(1, tl);
+
+	/* get in line first, so that the poller can wake us */
+	list_pushback(tl, runq.running);
+	swtch(find_work(1));
 }
 
 static void ready(task_t *task) {
 	task->status = STATUS_RUNNABLE;
+	task->readyts = stamp();
 	list_pushback(&runq.queue, task);
+	++runq.qlen;
 }
 
 static void unpark(task_t *task) {
@@ -491,11 +1081,20 @@ static void io_unpark(task_t *task) {
 	ready(task);
 }
 
+static int io_wake(tasklist_t *waiters) {
+	task_t *task = list_pop(waiters);
+	if (task == NULL)
+		return 0;
+	io_unpark(task);
+	return 1;
+}
+
 /* schedule the target task *immediately* with i/o cancellation */
 static void io_cancel_now(task_t *task) {
 	BUG_ON(task->status != STATUS_IOWAIT);
 	task->next = MAP_FAILED;
 	task->status = STATUS_RUNNABLE;
+	task->readyts = stamp();
 	--runq.iowait;
 	ready(runq.running); /* set currently-running task as runnable */
 	swtch(task);
@@ -518,11 +1117,62 @@ int wakeall(tasklist_t *tl) {
 	return out;
 }
 
+int requeue(tasklist_t *from, tasklist_t *to, int n) {
+	BUG_ON(from == &runq.queue || to == &runq.queue);
+	if (from->top == NULL || from == to)
+		return 0;
+	if (n >= 0) {
+		int moved;
+		for (moved = 0; moved < n && from->top != NULL; ++moved)
+			list_pushback(to, list_pop(from));
+		return moved;
+	}
+
+	/* splice the whole list */
+	if (to->top == NULL)
+		to->top = from->top;
+	else
+		to->tail->next = from->top;
+	to->tail = from->tail;
+	from->top = from->tail = NULL;
+	return 1;
+}
+
+/* a group member's start function returns its result */
+static void group_run(task_t *self) {
+	group_t *g = self->group;
+	if (g->canceled)
+		return;
+
+	word_t (*fn)(word_t) = (word_t (*)(word_t))self->start;
+	word_t res = fn(get_arg0(self->stack));
+	g->finished++;
+	if (g->results != NULL)
+		g->results[self->slot] = res;
+}
+
+/* a member is exiting; returns the joiner to run next, if it was the last one */
+static task_t *group_leave(group_t *g) {
+	if (--g->running != 0 || g->joiners.top == NULL)
+		return NULL;
+
+	task_t *joiner = list_pop(&g->joiners);
+	BUG_ON(joiner->status != STATUS_PARKED);
+	--runq.parked;
+	joiner->status = STATUS_RUNNABLE;
+	joiner->readyts = stamp();
+	wakeall(&g->joiners);
+	return joiner;
+}
+
 /* task entry point */
 __attribute__((noreturn))
 static void _sbrt_entry(void) {
 	task_t *self = runq.running;
-	self->start(get_arg0(self->stack));
+	if (unlikely(self->group != NULL))
+		group_run(self);
+	else
+		self->start(get_arg0(self->stack));
 	_sbrt_exit();
 }
 
@@ -530,7 +1180,12 @@ static void _sbrt_entry(void) {
 __attribute__((noreturn))
 static void run(task_t *task) {
 	BUG_ON(task->status != STATUS_RUNNABLE);
+	if (unlikely(rt.dog))
+		dog_tick(task);
+	if (unlikely(task->readyts != 0))
+		hist_add(&metrics.delay, ticks() - task->readyts);
 	smashing_check(task);
+	metrics.switches++;
 	runq.running = task;
 	task->status = STATUS_RUNNING;
 	_loadctx(&task->ctx);
@@ -542,23 +1197,64 @@ static void _sbrt_exit(void) {
 	/* free/clear old task state */
 	task_t *old = runq.running;
 	BUG_ON(old->status != STATUS_RUNNING);
+	if (unlikely(old->dirty != NULL))
+		flush_corks();
+	metrics.exits++;
+	if (unlikely(old->born != 0))
+		hist_add(&metrics.life, ticks() - old->born);
+
+	/* the last member of a group goes straight to the joiner */
+	task_t *joiner = NULL;
+	if (unlikely(old->group != NULL)) {
+		joiner = group_leave(old->group);
+		old->group = NULL;
+	}
 	old->status = STATUS_EMPTY;
 	old->start = NULL;
 
 	task_t *target;
-	if (runq.begin.top) {
+	if (unlikely(defer_stranded())) {
+		/* queued inline calls get the stack ahead of waiting spawners */
+		free_task(old);
+		start_runner();
+		target = (joiner != NULL) ? joiner : find_work(1);
+	} else if (runq.begin.top && joiner == NULL) {
 		target = task_handoff(old);
 	} else {
 		free_task(old);
-		target = find_work(1);
+		target = (joiner != NULL) ? joiner : find_work(1);
 	}
 	run(target);
 }
 
-void spawn(void (*start)(word_t), word_t data) {
+void spawn_budget(int tasks) {
+	runq.budget = tasks;
+}
+
+void spawn_limit(int tasks) {
+	theap.limit = tasks;
+}
+
+static void start_task(task_t *t, void (*start)(word_t), word_t data, size_t reserve) {
+	t->start = start;
+	setup(&t->ctx, t->stack, reserve, _sbrt_entry, data);
+	ready(t);
+	t->born = t->readyts;
+}
+
+/* get a new task for spawn(), blocking if necessary */
+static task_t *spawn_task(void) {
 	task_t *t;
+	int full = heap_at_limit();
 	
-	if (runq.begin.top || runq.queue.top) {
+	/*
+	   Allocate eagerly while we're under budget, but
+	   never jump ahead of tasks already waiting to allocate.
+	   At the limit, wait in line for a task to exit.
+	 */
+	if (runq.begin.top || full || (runq.queue.top && theap.used >= runq.budget)) {
+		if (full)
+			++theap.denied;
 		wait(&runq.begin);
 		t = runq.running->next;
 		runq.running->next = NULL;
@@ -569,83 +1265,2313 @@ void spawn(void (*start)(word_t), word_t data) {
 	if (unlikely(t == NULL))
 		panic("out of memory");
 
-	t->start = start;
-	setup(&t->ctx, t->stack, _sbrt_entry, data);
-	ready(t);
-	return;
+	return t;
 }
 
-static int park_and_iowait(task_t **addr) {
-	*addr = runq.running;
-	runq.running->status = STATUS_IOWAIT;
-	++runq.iowait;
-	swtch(find_work(1));
-	*addr = NULL;
+void spawn(void (*start)(word_t), word_t data) {
+	start_task(spawn_task(), start, data, 0);
+}
 
-	/* async wakeup due to cancelation */
-	if (unlikely(runq.running->next == MAP_FAILED)) {
-		runq.running->next = NULL;
+void spawn_with(void (*start)(word_t), const void *arg, size_t len) {
+	if (unlikely(len > SPAWN_WITH_MAX))
+		panic("spawn_with() argument too large");
+
+	task_t *t = spawn_task();
+	size_t reserve = (len + 15) & ~((size_t)15);
+	word_t data;
+	data.ptr = get_reserve(t->stack, reserve);
+	memcpy(data.ptr, arg, len);
+	start_task(t, start, data, reserve);
+}
+
+void group_init(group_t *g, word_t *results, int cap) {
+	memset(g, 0, sizeof(*g));
+	g->results = results;
+	g->cap = cap;
+}
+
+int group_spawn(group_t *g, word_t (*fn)(word_t), word_t arg) {
+	if (g->canceled) {
 		errno = ECANCELED;
 		return -1;
 	}
+	if (g->results != NULL && g->spawned == g->cap) {
+		errno = ENOSPC;
+		return -1;
+	}
 
-	return 0;
+	/* claim the slot first: spawn_task() may block */
+	int slot = g->spawned++;
+	g->running++;
+	if (g->results != NULL)
+		g->results[slot].val = 0;
+	task_t *t = spawn_task();
+	start_task(t, (void (*)(word_t))fn, arg, 0);
+	t->group = g;
+	t->slot = slot;
+	return slot;
 }
 
-void ioctx_cancel(ioctx_t *ctx) {
-	if (ctx->writer)
-		io_cancel_now(ctx->writer);
-	
-	if (ctx->reader)
-		io_cancel_now(ctx->reader);
-	
+void group_cancel(group_t *g) {
+	g->canceled = 1;
 }
 
-ssize_t ioctx_write(ioctx_t *ctx, char *buf, size_t bytes) {
-	if (unlikely(ctx->fd == -1)) {
-		errno = ECANCELED;
+int group_join(group_t *g) {
+	if (g->running > 0)
+		wait(&g->joiners);
+	return g->finished;
+}
+
+int try_spawn(void (*start)(word_t), word_t data) {
+	task_t *t;
+
+	/* don't cut in front of spawners already waiting in line */
+	if (heap_at_limit() || runq.begin.top) {
+		++theap.denied;
+		errno = EAGAIN;
 		return -1;
 	}
-	ssize_t amt;
-try:
-	amt = write(ctx->fd, buf, bytes);
-	if (amt == -1) {
-		switch (errno) {
-		case EAGAIN:
-			if (unlikely(ctx->writer))
-				panic("concurrent calls to ioctx_write()");
+	t = new_task();
+	if (unlikely(t == NULL)) {
+		++theap.denied;
+		errno = ENOMEM;
+		return -1;
+	}
+	start_task(t, start, data, 0);
+	return 0;
+}
 
-			if (unlikely(park_and_iowait(&ctx->writer) < 0))
-				return -1;
+static defer_chunk_t *defer_chunk(void) {
+	defer_chunk_t *c = defer.spare;
+	if (c) {
+		defer.spare = c->next;
+	} else {
+	do_map_chunk:
+		c = mmap(NULL, sizeof(defer_chunk_t), PROT_READ|PROT_WRITE,
+			 MAP_PRIVATE|MAP_ANON, -1, 0);
+		if (unlikely(c == MAP_FAILED)) {
+			if (errno == EINTR)
+				goto do_map_chunk;
 
-		case EINTR:
-			goto try;
+			panic("out of memory");
 		}
 	}
-	return amt;
+	c->next = NULL;
+	c->head = 0;
+	c->tail = 0;
+	return c;
 }
 
-ssize_t ioctx_read(ioctx_t *ctx, char *buf, size_t max) {
-	ssize_t amt;
-try:
-	amt = read(ctx->fd, buf, max);
-	if (amt == -1) {
-		switch (errno) {
-		case EAGAIN:
-			if (unlikely(ctx->reader))
-				panic("concurrent calls to ioctx_read()");
+static void defer_push(void (*fn)(word_t), word_t arg) {
+	defer_chunk_t *c = defer.tail;
+	if (c == NULL || c->tail == DEFER_CHUNK) {
+		c = defer_chunk();
+		if (defer.tail)
+			defer.tail->next = c;
+		else
+			defer.head = c;
+		
+		defer.tail = c;
+	}
+	c->calls[c->tail].fn = fn;
+	c->calls[c->tail].arg = arg;
+	++c->tail;
+}
 
-			if (unlikely(park_and_iowait(&ctx->reader) < 0))
-				return -1;
+static int defer_pop(void (**fn)(word_t), word_t *arg) {
+	defer_chunk_t *c = defer.head;
+	if (c == NULL || c->head == c->tail)
+		return 0;
 
-		case EINTR:
-			goto try;
+	*fn = c->calls[c->head].fn;
+	*arg = c->calls[c->head].arg;
+	if (++c->head == c->tail) {
+		if (c->next == NULL) {
+			/* drained; re-use the chunk from the start */
+			c->head = 0;
+			c->tail = 0;
+		} else {
+			defer.head = c->next;
+			c->next = defer.spare;
+			defer.spare = c;
 		}
 	}
-	return amt;
+	return 1;
+}
+
+static void run_deferred(word_t unused) {
+	task_t *self = runq.running;
+	void (*fn)(word_t);
+	word_t arg;
+	int n = 0;
+
+	for (;;) {
+		if (!defer_pop(&fn, &arg)) {
+			defer.runner = NULL;
+			return;
+		}
+
+		defer.calling = self;
+		fn(arg);
+		if (defer.calling != self) {
+			/* we blocked; take over again if nobody else has */
+			if (defer.runner != NULL)
+				return;
+			defer.runner = self;
+		}
+
+		defer.calling = NULL;
+		if (++n == DEFER_BATCH) {
+			n = 0;
+			sched();
+		}
+	}
+}
+
+/* returns -1 at the task limit; the queue waits for a task to exit */
+static int start_runner(void) {
+	if (heap_at_limit()) {
+		++theap.denied;
+		return -1;
+	}
+	task_t *t = new_task();
+	if (unlikely(t == NULL))
+		panic("out of memory");
+
+	defer.runner = t;
+	start_task(t, run_deferred, (word_t){ .val = 0 }, 0);
+	return 0;
+}
+
+/* the running inline call is about to block */
+static void defer_detach(void) {
+	defer.calling = NULL;
+	defer.runner = NULL;
+	if (defer_stranded())
+		start_runner();
+}
+
+void spawn_inline(void (*fn)(word_t), word_t arg) {
+	defer_push(fn, arg);
+	if (defer.runner == NULL)
+		start_runner();
+}
+
+/*
+   The system stack is a single mapping with a guard
+   page at the bottom. (Unlike task stacks, there are
+   few enough of these that the VMA doesn't matter.)
+ */
+static char *map_sysstack(void) {
+	char *mem;
+
+do_map_sysstack:
+	mem = mmap(NULL, SYSTEM_STACK_SIZE, PROT_READ|PROT_WRITE,
+		   MAP_PRIVATE|MAP_ANON, -1, 0);
+	if (unlikely(mem == MAP_FAILED)) {
+		if (errno == EINTR)
+			goto do_map_sysstack;
+
+		return NULL;
+	}
+	if (unlikely(mprotect(mem, getpagesize(), PROT_NONE) < 0)) {
+		int err = errno;
+		munmap(mem, SYSTEM_STACK_SIZE);
+		errno = err;
+		return NULL;
+	}
+	return mem + SYSTEM_STACK_SIZE;
+}
+
+__attribute__((noreturn))
+static void _sysstack_entry(void) {
+	sysstack.fn(sysstack.arg);
+	_loadctx(&sysstack.ret);
+}
+
+void chip_call_on_system_stack(void (*fn)(word_t), word_t arg) {
+	/* main() and nested calls are already on a big stack */
+	if (runq.running == &runq.t0 || sysstack.caller != NULL) {
+		fn(arg);
+		return;
+	}
+
+	if (unlikely(sysstack.top == NULL)) {
+		sysstack.top = map_sysstack();
+		if (sysstack.top == NULL)
+			panic("out of memory");
+	}
+
+	sysstack.caller = runq.running;
+	sysstack.fn = fn;
+	sysstack.arg = arg;
+	setup(&sysstack.ctx, sysstack.top, 0, _sysstack_entry, arg);
+	_swapctx(&sysstack.ret, &sysstack.ctx);
+	sysstack.caller = NULL;
+}
+
+/*
+   Blocking work is handed to a small pool of threads.
+   Each job lives on the stack of the task that is waiting
+   for it; finished jobs are handed back through the poller.
+ */
+#define OFFLOAD_THREADS 4
+
+struct offload_job_s {
+	offload_job_t *next;
+	void          (*fn)(word_t);
+	word_t        arg;
+	task_t        *task;
+	chip_rt_t     *rt;  /* where task lives */
+};
+
+/* shared by every thread's runtime */
+static struct {
+	pthread_mutex_t lock;
+	pthread_cond_t  cond;
+	offload_job_t   *head;    /* pending jobs */
+	offload_job_t   *tail;
+	int             threads;
+} offload = { PTHREAD_MUTEX_INITIALIZER, PTHREAD_COND_INITIALIZER };
+
+/* let the poller of 'target' know that it has work */
+static void notify(chip_rt_t *target) {
+	if (atomic_exchange(&target->pending, 1) == 0)
+		wakeup(target->wake);
+}
+
+static void *offload_worker(void *unused) {
+	offload_job_t *job;
+
+	for (;;) {
+		pthread_mutex_lock(&offload.lock);
+		while (offload.head == NULL)
+			pthread_cond_wait(&offload.cond, &offload.lock);
+		
+		job = offload.head;
+		offload.head = job->next;
+		if (offload.head == NULL)
+			offload.tail = NULL;
+		
+		pthread_mutex_unlock(&offload.lock);
+
+		job->fn(job->arg);
+
+		/* 'job' may be gone as soon as it is pushed */
+		chip_rt_t *target = job->rt;
+		offload_job_t *top = atomic_load_explicit(&target->done, memory_order_relaxed);
+		do {
+			job->next = top;
+		} while (!atomic_compare_exchange_weak_explicit(&target->done, &top, job,
+								memory_order_release,
+								memory_order_relaxed));
+		notify(target);
+	}
+	return NULL;
+}
+
+static int offload_start(void) {
+	pthread_t tid;
+	sigset_t all, old;
+	int err;
+
+	/* signals should be delivered to the scheduler thread */
+	sigfillset(&all);
+	pthread_sigmask(SIG_SETMASK, &all, &old);
+	while (offload.threads < OFFLOAD_THREADS) {
+		err = pthread_create(&tid, NULL, offload_worker, NULL);
+		if (err != 0)
+			break;
+		
+		pthread_detach(tid);
+		++offload.threads;
+	}
+	pthread_sigmask(SIG_SETMASK, &old, NULL);
+
+	if (offload.threads == 0) {
+		errno = err;
+		return -1;
+	}
+	return 0;
+}
+
+/* open this thread's runtime to wakeups from other threads */
+static int rt_wakeable(void) {
+	if (rt.wake != -1)
+		return 0;
+
+	rt.wake = wakeup_init();
+	return rt.wake == -1 ? -1 : 0;
+}
+
+int chip_offload(void (*fn)(word_t), word_t arg) {
+	sysstack_check();
+	if (unlikely(rt.wake == -1) && rt_wakeable() < 0)
+		return -1;
+
+	pthread_mutex_lock(&offload.lock);
+	if (unlikely(offload.threads == 0) && offload_start() < 0) {
+		pthread_mutex_unlock(&offload.lock);
+		return -1;
+	}
+	pthread_mutex_unlock(&offload.lock);
+
+	if (unlikely(defer.calling == runq.running))
+		defer_detach();
+	if (unlikely(runq.running->dirty != NULL))
+		flush_corks();
+	
+	offload_job_t job;
+	job.next = NULL;
+	job.fn = fn;
+	job.arg = arg;
+	job.task = runq.running;
+	job.rt = &rt;
+
+	pthread_mutex_lock(&offload.lock);
+	if (offload.tail)
+		offload.tail->next = &job;
+	else
+		offload.head = &job;
+	
+	offload.tail = &job;
+	pthread_cond_signal(&offload.cond);
+	pthread_mutex_unlock(&offload.lock);
+
+	runq.running->status = STATUS_IOWAIT;
+	++runq.iowait;
+	swtch(find_work(1));
+	return 0;
+}
+
+typedef struct {
+	int     fd;
+	char    *buf;
+	size_t  bytes;
+	off_t   off;
+	ssize_t ret;
+	int     err;
+} pio_t;
+
+static void do_pread(word_t arg) {
+	pio_t *p = arg.ptr;
+	do {
+		p->ret = pread(p->fd, p->buf, p->bytes, p->off);
+	} while (p->ret == -1 && errno == EINTR);
+	p->err = errno;
+}
+
+static void do_pwrite(word_t arg) {
+	pio_t *p = arg.ptr;
+	do {
+		p->ret = pwrite(p->fd, p->buf, p->bytes, p->off);
+	} while (p->ret == -1 && errno == EINTR);
+	p->err = errno;
+}
+
+static ssize_t pio(void (*fn)(word_t), ioctx_t *ctx, char *buf, size_t bytes, off_t off) {
+	if (unlikely(ctx->fd == -1)) {
+		errno = ECANCELED;
+		return -1;
+	}
+	pio_t p;
+	p.fd = ctx->fd;
+	p.buf = buf;
+	p.bytes = bytes;
+	p.off = off;
+
+	word_t arg;
+	arg.ptr = &p;
+	if (chip_offload(fn, arg) < 0)
+		return -1;
+	
+	if (p.ret == -1)
+		errno = p.err;
+	return p.ret;
+}
+
+ssize_t ioctx_pread(ioctx_t *ctx, char *buf, size_t bytes, off_t off) {
+	return pio(do_pread, ctx, buf, bytes, off);
+}
+
+ssize_t ioctx_pwrite(ioctx_t *ctx, char *buf, size_t bytes, off_t off) {
+	return pio(do_pwrite, ctx, buf, bytes, off);
+}
+
+/*
+   The log ring (see chip_log()). Producers copy their
+   arguments into fixed-size records without formatting
+   them; the drain task formats a batch of records into
+   one buffer and writes it with a single ioctx_write().
+   Like the rest of the runtime, the ring is per-thread,
+   so it needs no locks.
+ */
+#define LOG_RECORD  128  /* bytes per record */
+#define LOG_RECORDS 1024 /* must be a power of two */
+#define LOG_BUF     8192 /* formatted bytes per write */
+#define LOG_LINE    512  /* longest formatted record */
+
+typedef struct {
+	const char *fmt; /* NULL for chip_log_bytes() */
+	uint32_t   len;  /* bytes of data in use */
+	char       data[LOG_RECORD - sizeof(const char *) - sizeof(uint32_t)];
+} logrec_t;
+
+static _Thread_local struct {
+	logrec_t   *ring;
+	char       *buf;      /* LOG_BUF bytes */
+	unsigned   head;      /* next record to format */
+	unsigned   tail;      /* next record to fill */
+	uint64_t   dropped;
+	uint64_t   reported;  /* drops already written out */
+	ioctx_t    *out;
+	int        busy;      /* the drain task is writing */
+	int        closing;
+	tasklist_t idle;      /* the drain task, with nothing to do */
+	tasklist_t flushers;
+} logq;
+
+static logrec_t *log_claim(void) {
+	if (unlikely(logq.out == NULL || logq.closing))
+		return NULL;
+	if (logq.tail - logq.head == LOG_RECORDS) {
+		logq.dropped++;
+		return NULL;
+	}
+	if (logq.head == logq.tail)
+		wake(&logq.idle);
+	return &logq.ring[logq.tail++ & (LOG_RECORDS-1)];
+}
+
+/* argument widths, from the length modifier */
+#define LOG_INT   0 /* no length modifier */
+#define LOG_LONG  1 /* l */
+#define LOG_LLONG 2 /* ll */
+#define LOG_SIZE  3 /* z */
+
+static const char *log_conv(const char *p, int *l, char *c) {
+	*l = LOG_INT;
+	if (*p == 'z') {
+		*l = LOG_SIZE;
+		++p;
+	} else {
+		while (*p == 'l' && *l < LOG_LLONG) {
+			++*l;
+			++p;
+		}
+	}
+	*c = *p;
+	return p;
+}
+
+void chip_log(const char *fmt, ...) {
+	logrec_t *r = log_claim();
+	if (r == NULL)
+		return;
+
+	va_list ap;
+	uint32_t len = 0;
+	va_start(ap, fmt);
+	for (const char *p = fmt; *p; ++p) {
+		uint64_t v;
+		int l;
+		char c;
+		if (*p != '%')
+			continue;
+		p = log_conv(p+1, &l, &c);
+		switch (c) {
+		case 'd': case 'i':
+			/* stored sign-extended */
+			switch (l) {
+			case LOG_INT:   v = (uint64_t)va_arg(ap, int); break;
+			case LOG_LONG:  v = (uint64_t)va_arg(ap, long); break;
+			case LOG_LLONG: v = (uint64_t)va_arg(ap, long long); break;
+			default:        v = (uint64_t)va_arg(ap, ssize_t); break;
+			}
+			break;
+		case 'u': case 'x':
+			switch (l) {
+			case LOG_INT:   v = va_arg(ap, unsigned); break;
+			case LOG_LONG:  v = va_arg(ap, unsigned long); break;
+			case LOG_LLONG: v = va_arg(ap, unsigned long long); break;
+			default:        v = va_arg(ap, size_t); break;
+			}
+			break;
+		case 'c':
+			v = (uint64_t)va_arg(ap, int);
+			break;
+		case 'p':
+			v = (uintptr_t)va_arg(ap, void *);
+			break;
+		case 's': {
+			/* strings are copied, and may be truncated */
+			const char *s = va_arg(ap, const char *);
+			if (s == NULL)
+				s = "(null)";
+			while (len < sizeof(r->data)-1 && *s)
+				r->data[len++] = *s++;
+			if (len < sizeof(r->data))
+				r->data[len++] = 0;
+			continue;
+		}
+		case '\0':
+			--p;
+		default:
+			continue;
+		}
+		if (len + sizeof(v) > sizeof(r->data))
+			break;
+		memcpy(r->data+len, &v, sizeof(v));
+		len += sizeof(v);
+	}
+	va_end(ap);
+	r->fmt = fmt;
+	r->len = len;
+}
+
+void chip_log_bytes(const void *buf, size_t len) {
+	logrec_t *r = log_claim();
+	if (r == NULL)
+		return;
+	if (len > sizeof(r->data))
+		len = sizeof(r->data);
+	memcpy(r->data, buf, len);
+	r->fmt = NULL;
+	r->len = len;
+}
+
+static size_t log_num(char *out, uint64_t v, int base, int neg) {
+	char tmp[24];
+	int n = 0;
+	do {
+		tmp[n++] = "0123456789abcdef"[v % base];
+		v /= base;
+	} while (v);
+	size_t len = 0;
+	if (neg)
+		out[len++] = '-';
+	while (n)
+		out[len++] = tmp[--n];
+	return len;
+}
+
+/* truncate a stored argument back to the width it was passed with */
+static uint64_t log_narrow(uint64_t v, int l, int sign) {
+	switch (l) {
+	case LOG_INT:
+		return sign ? (uint64_t)(int)v : (unsigned)v;
+	case LOG_LONG:
+		return sign ? (uint64_t)(long)v : (unsigned long)v;
+	case LOG_SIZE:
+		return sign ? (uint64_t)(ssize_t)v : (size_t)v;
+	default:
+		return v;
+	}
+}
+
+/* format one record into at most LOG_LINE bytes of 'out' */
+static size_t log_format(const logrec_t *r, char *out) {
+	size_t len = 0;
+	uint32_t off = 0;
+
+	if (r->fmt == NULL) {
+		memcpy(out, r->data, r->len);
+		return r->len;
+	}
+	for (const char *p = r->fmt; *p && len < LOG_LINE-32; ++p) {
+		uint64_t v;
+		int l;
+		char c;
+		if (*p != '%') {
+			out[len++] = *p;
+			continue;
+		}
+		p = log_conv(p+1, &l, &c);
+		if (c == '%') {
+			out[len++] = '%';
+			continue;
+		}
+		if (c == '\0')
+			break;
+		if (c == 's') {
+			while (off < r->len && r->data[off] && len < LOG_LINE-32)
+				out[len++] = r->data[off++];
+			while (off < r->len && r->data[off])
+				off++;
+			off++;
+			continue;
+		}
+		if (off + sizeof(v) > r->len) {
+			out[len++] = '?';
+			continue;
+		}
+		memcpy(&v, r->data+off, sizeof(v));
+		off += sizeof(v);
+		switch (c) {
+		case 'd': case 'i':
+			v = log_narrow(v, l, 1);
+			len += log_num(out+len, ((int64_t)v < 0) ? -v : v, 10, (int64_t)v < 0);
+			break;
+		case 'u':
+			len += log_num(out+len, log_narrow(v, l, 0), 10, 0);
+			break;
+		case 'x':
+			len += log_num(out+len, log_narrow(v, l, 0), 16, 0);
+			break;
+		case 'p':
+			out[len++] = '0';
+			out[len++] = 'x';
+			len += log_num(out+len, v, 16, 0);
+			break;
+		case 'c':
+			out[len++] = (char)v;
+			break;
+		default:
+			out[len++] = '?';
+		}
+	}
+	if (len == 0 || out[len-1] != '\n')
+		out[len++] = '\n';
+	return len;
+}
+
+static void log_drain(word_t arg) {
+	for (;;) {
+		while (logq.head == logq.tail && !logq.closing) {
+			wakeall(&logq.flushers);
+			wait(&logq.idle);
+		}
+		if (logq.head == logq.tail)
+			break;
+
+		size_t len = 0;
+		while (logq.head != logq.tail && len <= LOG_BUF-LOG_LINE-64) {
+			if (unlikely(logq.dropped != logq.reported)) {
+				static const char msg[] = "chip_log: dropped ";
+				memcpy(logq.buf+len, msg, sizeof(msg)-1);
+				len += sizeof(msg)-1;
+				len += log_num(logq.buf+len, logq.dropped - logq.reported, 10, 0);
+				memcpy(logq.buf+len, " records\n", 9);
+				len += 9;
+				logq.reported = logq.dropped;
+			}
+			len += log_format(&logq.ring[logq.head & (LOG_RECORDS-1)], logq.buf+len);
+			logq.head++;
+		}
+
+		logq.busy = 1;
+		for (size_t done = 0; done < len; ) {
+			ssize_t amt = ioctx_write(logq.out, logq.buf+done, len-done);
+			if (amt <= 0)
+				break; /* nowhere to put it */
+			done += amt;
+		}
+		logq.busy = 0;
+	}
+	logq.out = NULL;
+	logq.closing = 0;
+	wakeall(&logq.flushers);
+}
+
+int chip_log_open(ioctx_t *out) {
+	if (logq.out != NULL) {
+		errno = EBUSY;
+		return -1;
+	}
+	if (logq.ring == NULL) {
+		char *mem = mmap(NULL, LOG_RECORDS*sizeof(logrec_t) + LOG_BUF, PROT_READ|PROT_WRITE,
+				 MAP_PRIVATE|MAP_ANON, -1, 0);
+		if (mem == MAP_FAILED)
+			return -1;
+		logq.ring = (logrec_t *)mem;
+		logq.buf = mem + LOG_RECORDS*sizeof(logrec_t);
+	}
+	logq.out = out;
+	logq.head = logq.tail = 0;
+
+	word_t arg;
+	arg.ptr = NULL;
+	spawn(log_drain, arg);
+	return 0;
+}
+
+void chip_log_flush(void) {
+	while (logq.out != NULL && (logq.head != logq.tail || logq.busy))
+		wait(&logq.flushers);
+}
+
+void chip_log_close(void) {
+	if (logq.out == NULL || logq.closing)
+		return;
+	logq.closing = 1;
+	wake(&logq.idle);
+	while (logq.out != NULL)
+		wait(&logq.flushers);
+}
+
+uint64_t chip_log_dropped(void) {
+	return logq.dropped;
+}
+
+/*
+   A mailbox is a bounded multi-producer, single-consumer
+   queue of calls (after Vyukov). Each slot's sequence number
+   says whether it is free to be written for lap 'pos', or
+   ready to be read.
+ */
+#define MAILBOX_SIZE 1024 /* must be a power of two */
+
+struct mailbox_s {
+	atomic_size_t head; /* next slot to claim (producers) */
+	char          pad[64];
+	size_t        tail; /* next slot to read (consumer) */
+	struct {
+		atomic_size_t seq;
+		void          (*fn)(word_t);
+		word_t        arg;
+	} slots[MAILBOX_SIZE];
+};
+
+chip_rt_t *chip_self(void) {
+	mailbox_t *m;
+
+	if (rt.mail)
+		return &rt;
+
+	if (rt_wakeable() < 0)
+		return NULL;
+	
+do_map_mailbox:
+	m = mmap(NULL, sizeof(mailbox_t), PROT_READ|PROT_WRITE,
+		 MAP_PRIVATE|MAP_ANON, -1, 0);
+	if (unlikely(m == MAP_FAILED)) {
+		if (errno == EINTR)
+			goto do_map_mailbox;
+
+		return NULL;
+	}
+	for (size_t i=0; i<MAILBOX_SIZE; ++i)
+		atomic_init(&m->slots[i].seq, i);
+	
+	atomic_init(&m->head, 0);
+	m->tail = 0;
+	rt.mail = m;
+	return &rt;
+}
+
+int chip_post(chip_rt_t *target, void (*fn)(word_t), word_t arg) {
+	mailbox_t *m = target->mail;
+	size_t pos = atomic_load_explicit(&m->head, memory_order_relaxed);
+	size_t seq;
+
+	for (;;) {
+		seq = atomic_load_explicit(&m->slots[pos&(MAILBOX_SIZE-1)].seq, memory_order_acquire);
+		if (seq == pos) {
+			if (atomic_compare_exchange_weak_explicit(&m->head, &pos, pos+1,
+								  memory_order_relaxed,
+								  memory_order_relaxed))
+				break;
+		} else if ((intptr_t)(seq - pos) < 0) {
+			errno = EAGAIN;
+			return -1;
+		} else {
+			pos = atomic_load_explicit(&m->head, memory_order_relaxed);
+		}
+	}
+
+	m->slots[pos&(MAILBOX_SIZE-1)].fn = fn;
+	m->slots[pos&(MAILBOX_SIZE-1)].arg = arg;
+	atomic_store_explicit(&m->slots[pos&(MAILBOX_SIZE-1)].seq, pos+1, memory_order_release);
+	notify(target);
+	return 0;
+}
+
+/* hand mail over to spawn_inline() */
+static int mail_deliver(mailbox_t *m) {
+	int n = 0;
+	for (;;) {
+		size_t pos = m->tail;
+		size_t seq = atomic_load_explicit(&m->slots[pos&(MAILBOX_SIZE-1)].seq, memory_order_acquire);
+		if (seq != pos+1)
+			break;
+		
+		void (*fn)(word_t) = m->slots[pos&(MAILBOX_SIZE-1)].fn;
+		word_t arg = m->slots[pos&(MAILBOX_SIZE-1)].arg;
+		atomic_store_explicit(&m->slots[pos&(MAILBOX_SIZE-1)].seq, pos+MAILBOX_SIZE, memory_order_release);
+		m->tail = pos+1;
+		spawn_inline(fn, arg);
+		++n;
+	}
+	return n;
+}
+
+static int handle_wakeup(void) {
+	/* clear this first, so later notify()s aren't lost */
+	atomic_store(&rt.pending, 0);
+
+	int woke = 0;
+	offload_job_t *job = atomic_exchange_explicit(&rt.done, NULL, memory_order_acquire);
+	while (job) {
+		offload_job_t *next = job->next;
+		io_unpark(job->task);
+		job = next;
+		++woke;
+	}
+
+	if (rt.mail)
+		woke += mail_deliver(rt.mail);
+	
+	return woke;
+}
+
+/* 
+   The watchdog thread samples its runtime's switch counter
+   a few times per threshold. If the counter hasn't moved (and
+   the runtime isn't just waiting in the poller), the running
+   task has hogged the CPU: say so, once, and ask the task
+   to yield at its next preemption point.
+ */
+static void *watchdog(void *arg) {
+	chip_rt_t *r = arg;
+	unsigned long last = 0;
+	int64_t since = now_nsec();
+	int reported = 0;
+	int ms;
+
+	for (;;) {
+		ms = atomic_load(&r->dog_ms);
+		if (ms == 0)
+			return NULL; /* chip_watchdog(0) is waiting in pthread_join() */
+
+		/* short enough that stopping doesn't take long, either */
+		struct timespec ts;
+		int tick = (ms >= 4) ? ms/4 : 1;
+		if (tick > 100)
+			tick = 100;
+		ts.tv_sec = tick/1000;
+		ts.tv_nsec = (long)(tick%1000)*1000000;
+		nanosleep(&ts, NULL);
+
+		int64_t now = now_nsec();
+		unsigned long epoch = atomic_load_explicit(&r->epoch, memory_order_relaxed);
+		if (epoch != last || atomic_load_explicit(&r->idle, memory_order_relaxed)) {
+			last = epoch;
+			since = now;
+			reported = 0;
+			continue;
+		}
+		if (reported || now - since < (int64_t)ms*1000000)
+			continue;
+
+		reported = 1;
+		atomic_store_explicit(&r->preempt, 1, memory_order_relaxed);
+
+		char msg[128];
+		uintptr_t start = atomic_load_explicit(&r->current, memory_order_relaxed);
+		int len;
+		if (start)
+			len = snprintf(msg, sizeof(msg), "chip: task started at %#lx has run for %ldms without yielding\n",
+			               (unsigned long)start, (long)((now - since)/1000000));
+		else
+			len = snprintf(msg, sizeof(msg), "chip: main task has run for %ldms without yielding\n",
+			               (long)((now - since)/1000000));
+		write(STDERR_FILENO, msg, len);
+	}
+}
+
+int chip_watchdog(int ms) {
+	if (ms <= 0) {
+		rt.dog = 0;
+		if (atomic_load(&rt.dog_ms) == -1)
+			return 0;
+
+		/* the thread reads our (thread-local) state, so it must be gone */
+		atomic_store(&rt.dog_ms, 0);
+		pthread_join(rt.dogtid, NULL);
+		atomic_store(&rt.dog_ms, -1);
+		return 0;
+	}
+
+	dog_tick(runq.running);
+	rt.dog = 1;
+	if (atomic_load(&rt.dog_ms) != -1) {
+		atomic_store(&rt.dog_ms, ms);
+		return 0;
+	}
+
+	sigset_t all, old;
+	int err;
+
+	atomic_store(&rt.dog_ms, ms);
+	sigfillset(&all);
+	pthread_sigmask(SIG_SETMASK, &all, &old);
+	err = pthread_create(&rt.dogtid, NULL, watchdog, &rt);
+	pthread_sigmask(SIG_SETMASK, &old, NULL);
+	if (err != 0) {
+		atomic_store(&rt.dog_ms, -1);
+		rt.dog = 0;
+		errno = err;
+		return -1;
+	}
+	return 0;
+}
+
+#define preempt_point() do { \
+	if (unlikely(atomic_load_explicit(&rt.preempt, memory_order_relaxed)) && sysstack.caller == NULL) \
+		sched(); \
+	} while (0)
+
+void chip_maybe_yield(void) {
+	preempt_point();
+}
+
+/*
+   The sampling profiler (see chip_profile_start()). SIGPROF
+   is handled on whichever thread was burning CPU; if that
+   thread is profiling, the handler copies the interrupted
+   task's frame pointer chain into the thread's sample ring,
+   without leaving the stack the task was interrupted on.
+ */
+#define PROF_DEPTH   30
+#define PROF_SAMPLES 4096
+#define PROF_LINE    (32*(PROF_DEPTH+2)) /* longest folded line */
+#define PROF_BUF     (2*PROF_LINE)
+
+typedef struct {
+	task_t    *task;
+	void      (*start)(word_t);
+	int       depth;  /* zero once written out */
+	uintptr_t pc[PROF_DEPTH]; /* innermost first */
+} prof_sample_t;
+
+static _Thread_local struct {
+	prof_sample_t *ring;
+	char          *buf;      /* PROF_BUF bytes, for chip_profile_write() */
+	volatile sig_atomic_t on;
+	unsigned      used;
+	uint64_t      dropped;   /* samples that didn't fit */
+	uintptr_t     t0_lo, t0_hi; /* the thread's own stack */
+} prof;
+
+static struct {
+	pthread_mutex_t lock;
+	int             threads;   /* profiling */
+	int             installed; /* the SIGPROF handler */
+} profiler = { PTHREAD_MUTEX_INITIALIZER, 0, 0 };
+
+static void prof_signal(int sig, siginfo_t *info, void *uctx) {
+	uintptr_t pc, sp, fp, lo, hi;
+	task_t *task = runq.running;
+
+	if (!prof.on)
+		return;
+	if (prof.used == PROF_SAMPLES) {
+		prof.dropped++;
+		return;
+	}
+
+	uctx_regs(uctx, &pc, &sp, &fp);
+	if (sysstack.caller != NULL) {
+		lo = (uintptr_t)sysstack.top - SYSTEM_STACK_SIZE;
+		hi = (uintptr_t)sysstack.top;
+	} else if (task == &runq.t0) {
+		lo = prof.t0_lo;
+		hi = prof.t0_hi;
+	} else {
+		lo = (uintptr_t)task->stack - STACK_SIZE;
+		hi = (uintptr_t)task->stack;
+	}
+	/* in the middle of a switch, or on a stack we don't know */
+	if (sp < lo || sp >= hi)
+		fp = 0;
+
+	prof_sample_t *s = &prof.ring[prof.used];
+	int n = 0;
+	s->task = task;
+	s->start = task->start;
+	s->pc[n++] = pc;
+	while (n < PROF_DEPTH && fp >= sp && fp%sizeof(uintptr_t) == 0 && fp+2*sizeof(uintptr_t) <= hi) {
+		const uintptr_t *frame = (const uintptr_t *)fp;
+		if (frame[1] == 0)
+			break;
+		s->pc[n++] = frame[1];
+		if (frame[0] <= fp)
+			break;
+		fp = frame[0];
+	}
+	s->depth = n;
+	prof.used++;
+}
+
+static void prof_t0_bounds(void) {
+#if defined(__linux__)
+	pthread_attr_t attr;
+	void *addr;
+	size_t size;
+	if (pthread_getattr_np(pthread_self(), &attr) != 0)
+		return;
+	if (pthread_attr_getstack(&attr, &addr, &size) == 0) {
+		prof.t0_lo = (uintptr_t)addr;
+		prof.t0_hi = (uintptr_t)addr + size;
+	}
+	pthread_attr_destroy(&attr);
+#elif defined(__APPLE__)
+	prof.t0_hi = (uintptr_t)pthread_get_stackaddr_np(pthread_self());
+	prof.t0_lo = prof.t0_hi - pthread_get_stacksize_np(pthread_self());
+#endif
+}
+
+int chip_profile_start(int hz) {
+	if (hz <= 0 || hz > 1000000) {
+		errno = EINVAL;
+		return -1;
+	}
+	if (prof.ring == NULL) {
+		char *mem = mmap(NULL, PROF_SAMPLES*sizeof(prof_sample_t) + PROF_BUF, PROT_READ|PROT_WRITE,
+				 MAP_PRIVATE|MAP_ANON, -1, 0);
+		if (mem == MAP_FAILED)
+			return -1;
+		prof.ring = (prof_sample_t *)mem;
+		prof.buf = mem + PROF_SAMPLES*sizeof(prof_sample_t);
+		prof_t0_bounds();
+	}
+
+	pthread_mutex_lock(&profiler.lock);
+	if (!profiler.installed) {
+		struct sigaction sa;
+		memset(&sa, 0, sizeof(sa));
+		sa.sa_sigaction = prof_signal;
+		sa.sa_flags = SA_SIGINFO|SA_RESTART;
+		sigemptyset(&sa.sa_mask);
+		if (sigaction(SIGPROF, &sa, NULL) == -1) {
+			pthread_mutex_unlock(&profiler.lock);
+			return -1;
+		}
+		profiler.installed = 1;
+	}
+
+	struct itimerval it;
+	long usec = 1000000/hz;
+	it.it_interval.tv_sec = usec/1000000;
+	it.it_interval.tv_usec = usec%1000000;
+	it.it_value = it.it_interval;
+	if (setitimer(ITIMER_PROF, &it, NULL) == -1) {
+		pthread_mutex_unlock(&profiler.lock);
+		return -1;
+	}
+	if (!prof.on)
+		profiler.threads++;
+	prof.on = 1;
+	pthread_mutex_unlock(&profiler.lock);
+	return 0;
+}
+
+void chip_profile_stop(void) {
+	if (!prof.on)
+		return;
+
+	pthread_mutex_lock(&profiler.lock);
+	prof.on = 0;
+	if (--profiler.threads == 0) {
+		/* the handler stays: a SIGPROF may already be pending */
+		struct itimerval it;
+		memset(&it, 0, sizeof(it));
+		setitimer(ITIMER_PROF, &it, NULL);
+	}
+	pthread_mutex_unlock(&profiler.lock);
+}
+
+static int write_all(int fd, const char *buf, size_t len) {
+	while (len) {
+		ssize_t amt = write(fd, buf, len);
+		if (amt == -1) {
+			if (errno == EINTR)
+				continue;
+			return -1;
+		}
+		buf += amt;
+		len -= amt;
+	}
+	return 0;
+}
+
+static int prof_same(const prof_sample_t *a, const prof_sample_t *b, int flags) {
+	if (a->start != b->start || a->depth != b->depth)
+		return 0;
+	if ((flags&CHIP_PROFILE_TASKS) && a->task != b->task)
+		return 0;
+	return memcmp(a->pc, b->pc, a->depth*sizeof(uintptr_t)) == 0;
+}
+
+/* "0x..." without printf, which needs more stack than a task may have */
+static size_t prof_addr(char *out, uintptr_t v) {
+	out[0] = '0';
+	out[1] = 'x';
+	return 2 + log_num(out+2, v, 16, 0);
+}
+
+int chip_profile_write(int fd, int flags) {
+	char *buf = prof.buf;
+	size_t len = 0;
+	int err = 0;
+	sigset_t set, old;
+
+	if (prof.ring == NULL)
+		return 0;
+
+	sigemptyset(&set);
+	sigaddset(&set, SIGPROF);
+	pthread_sigmask(SIG_BLOCK, &set, &old);
+	for (unsigned i=0; i<prof.used && !err; ++i) {
+		prof_sample_t *s = &prof.ring[i];
+		uint64_t count = 1;
+		if (s->depth == 0)
+			continue;
+		for (unsigned j=i+1; j<prof.used; ++j) {
+			if (prof.ring[j].depth && prof_same(s, &prof.ring[j], flags)) {
+				prof.ring[j].depth = 0;
+				count++;
+			}
+		}
+
+		/* outermost frame first; the task's start function is the root */
+		word_t start;
+		start.fnptr = (void (*)(void))s->start;
+		if (s->start) {
+			len += prof_addr(buf+len, start.val);
+		} else {
+			memcpy(buf+len, "main", 4);
+			len += 4;
+		}
+		if (flags&CHIP_PROFILE_TASKS) {
+			memcpy(buf+len, ";task@", 6);
+			len += 6;
+			len += prof_addr(buf+len, (uintptr_t)s->task);
+		}
+		for (int k=s->depth-1; k>=0; --k) {
+			buf[len++] = ';';
+			len += prof_addr(buf+len, s->pc[k]);
+		}
+		buf[len++] = ' ';
+		len += log_num(buf+len, count, 10, 0);
+		buf[len++] = '\n';
+		if (len > PROF_BUF-PROF_LINE) {
+			err = write_all(fd, buf, len);
+			len = 0;
+		}
+	}
+	if (!err && prof.dropped) {
+		memcpy(buf+len, "[dropped] ", 10);
+		len += 10;
+		len += log_num(buf+len, prof.dropped, 10, 0);
+		buf[len++] = '\n';
+	}
+	if (!err && len)
+		err = write_all(fd, buf, len);
+	prof.used = 0;
+	prof.dropped = 0;
+	pthread_sigmask(SIG_SETMASK, &old, NULL);
+	return err;
+}
+
+static int park_and_iowait(ioctx_t *ctx, tasklist_t *waiters) {
+	sysstack_check();
+	if (unlikely(!(ctx->flags&IOCTX_ARMED))) {
+		if (!(ctx->flags&IOCTX_NOPOLL) && ioctx_arm(ctx) < 0 && !(ctx->flags&IOCTX_NOPOLL))
+			return -1;
+		if (ctx->flags&IOCTX_NOPOLL) {
+			/* nothing will ever report it ready; yield, then retry */
+			sched();
+			return 0;
+		}
+	}
+	if (unlikely(defer.calling == runq.running))
+		defer_detach();
+	if (unlikely(runq.running->dirty != NULL))
+		flush_corks();
+
+	ioctx_stats_t *st = ctx->stats;
+	int64_t since = 0;
+	if (unlikely(st != NULL)) {
+		st->parks++;
+		since = now_nsec();
+	}
+
+	runq.running->status = STATUS_IOWAIT;
+	++runq.iowait;
+	list_pushback(waiters, runq.running);
+	swtch(find_work(1));
+
+	/* async wakeup due to cancelation */
+	if (unlikely(runq.running->next == MAP_FAILED)) {
+		runq.running->next = NULL;
+		errno = ECANCELED;
+		return -1;
+	}
+
+	if (unlikely(st != NULL) && ctx->stats == st)
+		st->iowait += now_nsec() - since;
+
+	return 0;
+}
+
+/* 
+   The poller wakes one waiter per readiness edge. Since
+   edges are only reported once, a waiter that gets somewhere
+   passes the baton to the next one in line; if the fd turns
+   out to be drained, that task simply waits again.
+ */
+#define io_chain(waiters) do { if (unlikely((waiters)->top != NULL)) io_wake(waiters); } while (0)
+
+/* 
+   Accounting for ioctx_track(). Every syscall also
+   counts towards the thread's total (see chip_stats_publish()).
+ */
+static _Thread_local ioctx_stats_t *tracked;
+
+static inline void io_syscall(ioctx_t *ctx) {
+	metrics.iocalls++;
+	if (unlikely(ctx->stats != NULL))
+		ctx->stats->syscalls++;
+}
+
+static inline void io_again(ioctx_t *ctx) {
+	if (unlikely(ctx->stats != NULL))
+		ctx->stats->eagain++;
+}
+
+static inline void io_read(ioctx_t *ctx, ssize_t amt) {
+	if (unlikely(ctx->stats != NULL) && amt > 0)
+		ctx->stats->rbytes += amt;
+}
+
+static inline void io_wrote(ioctx_t *ctx, ssize_t amt) {
+	if (unlikely(ctx->stats != NULL) && amt > 0)
+		ctx->stats->wbytes += amt;
+}
+
+/* 'stats' may be uninitialized, so we can't look at stats->ctx */
+void ioctx_track(ioctx_t *ctx, ioctx_stats_t *stats) {
+	if (ctx->stats != NULL)
+		ioctx_untrack(ctx);
+	memset(stats, 0, sizeof(*stats));
+	stats->ctx = ctx;
+	stats->next = tracked;
+	if (tracked != NULL)
+		tracked->prev = stats;
+	tracked = stats;
+	ctx->stats = stats;
+}
+
+static void ioctx_untrack(ioctx_t *ctx) {
+	ioctx_stats_t *st = ctx->stats;
+	if (st->prev != NULL)
+		st->prev->next = st->next;
+	else
+		tracked = st->next;
+	if (st->next != NULL)
+		st->next->prev = st->prev;
+	st->prev = st->next = NULL;
+	st->ctx = NULL;
+	ctx->stats = NULL;
+}
+
+ioctx_stats_t *ioctx_tracked(ioctx_stats_t *prev) {
+	return prev == NULL ? tracked : prev->next;
+}
+
+static void cancel_all(tasklist_t *waiters) {
+	/* 
+	   Take the whole list first: a canceled task
+	   that retries must wait for the next cancelation.
+	 */
+	task_t *task = waiters->top;
+	waiters->top = NULL;
+	waiters->tail = NULL;
+	while (task) {
+		task_t *next = task->next;
+		task->next = NULL;
+		io_cancel_now(task);
+		task = next;
+	}
+}
+
+void ioctx_cancel(ioctx_t *ctx) {
+	cancel_all(&ctx->writers);
+	cancel_all(&ctx->readers);
+
+	/* canceled acceptors unlink themselves before we get back */
+again:
+	for (pauser_t *p = codel.paused; p; p = p->next) {
+		if (p->ctx == ctx && p->waiting.top) {
+			cancel_all(&p->waiting);
+			goto again;
+		}
+	}
+}
+
+/* 
+   Corked writes: each task keeps a list of the corks it has
+   buffered data in, and flushes them (without blocking) before
+   it gives up the CPU. Whatever can't be written then is left
+   for the poller to flush when the fd becomes writeable.
+ */
+static void cork_consume(iocork_t *c, size_t amt) {
+	c->len -= amt;
+	if (c->len)
+		memmove(c->buf, c->buf+amt, c->len);
+}
+
+static void cork_unlink(iocork_t *c) {
+	iocork_t **pp = &c->owner->dirty;
+	while (*pp != c)
+		pp = &(*pp)->next;
+	*pp = c->next;
+	c->next = NULL;
+	c->owner = NULL;
+}
+
+static void cork_mark(iocork_t *c) {
+	if (c->owner == runq.running)
+		return;
+	if (c->owner)
+		cork_unlink(c);
+	c->owner = runq.running;
+	c->next = runq.running->dirty;
+	runq.running->dirty = c;
+}
+
+static void cork_flush(iocork_t *c) {
+	ssize_t amt;
+	while (c->len) {
+		io_syscall(c->ctx);
+		amt = write(c->ctx->fd, c->buf, c->len);
+		if (amt == -1) {
+			if (errno == EINTR)
+				continue;
+			if (errno != EAGAIN) {
+				c->err = errno;
+				c->len = 0;
+				return;
+			}
+			io_again(c->ctx);
+			if (!(c->ctx->flags&(IOCTX_ARMED|IOCTX_NOPOLL))) {
+				/* the poller finishes the job */
+				ioctx_arm(c->ctx);
+			}
+			return;
+		}
+		io_wrote(c->ctx, amt);
+		cork_consume(c, amt);
+	}
+}
+
+static void flush_corks(void) {
+	iocork_t *c = runq.running->dirty;
+	runq.running->dirty = NULL;
+	while (c) {
+		iocork_t *next = c->next;
+		c->next = NULL;
+		c->owner = NULL;
+		cork_flush(c);
+		c = next;
+	}
+}
+
+static void cork_drop(ioctx_t *ctx) {
+	iocork_t *c = ctx->cork;
+	cork_flush(c);
+	if (c->owner)
+		cork_unlink(c);
+	ctx->cork = NULL;
+}
+
+static int cork_error(iocork_t *c) {
+	errno = c->err;
+	c->err = 0;
+	return -1;
+}
+
+static ssize_t cork_write(ioctx_t *ctx, char *buf, size_t bytes) {
+	iocork_t *c = ctx->cork;
+	if (unlikely(c->err))
+		return cork_error(c);
+
+	size_t done = 0;
+	while (c->len + bytes > c->cap) {
+		struct iovec iov[2];
+		iov[0].iov_base = c->buf;
+		iov[0].iov_len = c->len;
+		iov[1].iov_base = buf;
+		iov[1].iov_len = bytes;
+		io_syscall(ctx);
+		ssize_t amt = writev(ctx->fd, iov, 2);
+		io_wrote(ctx, amt);
+		if (amt == -1) {
+			switch (errno) {
+			case EAGAIN:
+				io_again(ctx);
+				if (unlikely(park_and_iowait(ctx, &ctx->writers) < 0))
+					return done ? (ssize_t)done : -1;
+				
+			case EINTR:
+				continue;
+			default:
+				return done ? (ssize_t)done : -1;
+			}
+		}
+		if ((size_t)amt < c->len) {
+			cork_consume(c, amt);
+			continue;
+		}
+		amt -= c->len;
+		c->len = 0;
+		buf += amt;
+		bytes -= amt;
+		done += amt;
+	}
+
+	memcpy(c->buf+c->len, buf, bytes);
+	c->len += bytes;
+	done += bytes;
+	if (c->len)
+		cork_mark(c);
+	io_chain(&ctx->writers);
+	return done;
+}
+
+void ioctx_cork(ioctx_t *ctx, iocork_t *cork, char *buf, size_t cap) {
+	BUG_ON(ctx->cork != NULL);
+	cork->ctx = ctx;
+	cork->buf = buf;
+	cork->cap = cap;
+	cork->len = 0;
+	cork->err = 0;
+	cork->owner = NULL;
+	cork->next = NULL;
+	ctx->cork = cork;
+}
+
+int ioctx_flush(ioctx_t *ctx) {
+	iocork_t *c = ctx->cork;
+	if (c == NULL)
+		return 0;
+	if (unlikely(c->err))
+		return cork_error(c);
+
+	ssize_t amt;
+	while (c->len) {
+		io_syscall(ctx);
+		amt = write(ctx->fd, c->buf, c->len);
+		if (amt == -1) {
+			switch (errno) {
+			case EAGAIN:
+				io_again(ctx);
+				if (unlikely(park_and_iowait(ctx, &ctx->writers) < 0))
+					return -1;
+				
+			case EINTR:
+				continue;
+			default:
+				return -1;
+			}
+		}
+		io_wrote(ctx, amt);
+		cork_consume(c, amt);
+	}
+	io_chain(&ctx->writers);
+	/* parking may have recorded an error */
+	if (unlikely(c->err))
+		return cork_error(c);
+	return 0;
+}
+
+int ioctx_uncork(ioctx_t *ctx) {
+	iocork_t *c = ctx->cork;
+	if (c == NULL)
+		return 0;
+	int res = ioctx_flush(ctx);
+	if (c->owner)
+		cork_unlink(c);
+	ctx->cork = NULL;
+	return res;
+}
+
+ssize_t ioctx_write(ioctx_t *ctx, char *buf, size_t bytes) {
+	if (unlikely(ctx->fd == -1)) {
+		errno = ECANCELED;
+		return -1;
+	}
+	if (ctx->cork) {
+		ssize_t res = cork_write(ctx, buf, bytes);
+		if (res >= 0)
+			preempt_point();
+		return res;
+	}
+	
+	ssize_t amt;
+try:
+	io_syscall(ctx);
+	amt = write(ctx->fd, buf, bytes);
+	if (amt == -1) {
+		switch (errno) {
+		case EAGAIN:
+			io_again(ctx);
+			if (unlikely(park_and_iowait(ctx, &ctx->writers) < 0))
+				return -1;
+
+		case EINTR:
+			goto try;
+		}
+	}
+	io_wrote(ctx, amt);
+	io_chain(&ctx->writers);
+	if (amt >= 0)
+		preempt_point(); /* sched() may clobber errno */
+	return amt;
+}
+
+ssize_t ioctx_read(ioctx_t *ctx, char *buf, size_t max) {
+	if (unlikely(ctx->fd == -1)) {
+		errno = ECANCELED;
+		return -1;
+	}
+	ssize_t amt;
+try:
+	io_syscall(ctx);
+	amt = read(ctx->fd, buf, max);
+	if (amt == -1) {
+		switch (errno) {
+		case EAGAIN:
+			io_again(ctx);
+			if (unlikely(park_and_iowait(ctx, &ctx->readers) < 0))
+				return -1;
+
+		case EINTR:
+			goto try;
+		}
+	}
+	io_read(ctx, amt);
+	io_chain(&ctx->readers);
+	if (amt >= 0)
+		preempt_point();
+	return amt;
+}
+
+/*
+   I/O buffers are carved out of mmap()ed slabs, and
+   kept on per-size-class free lists. Every buffer is
+   preceded by a small header that records its class.
+ */
+#define IOBUF_MIN_SHIFT 9  /* 512 bytes */
+#define IOBUF_CLASSES   8  /* ... through 64kB */
+#define IOBUF_SLAB      16 /* buffers per slab */
+
+typedef union iobuf_hdr_u iobuf_hdr_t;
+
+union iobuf_hdr_u {
+	struct {
+		iobuf_hdr_t *next;
+		int         class;
+	} h;
+	char align[16];
+};
+
+static _Thread_local iobuf_hdr_t *iobufs[IOBUF_CLASSES];
+
+static int iobuf_class(size_t size) {
+	int class = 0;
+	while (((size_t)1<<(class+IOBUF_MIN_SHIFT)) < size)
+		++class;
+	
+	return class;
+}
+
+static int map_iobufs(int class) {
+	size_t stride = sizeof(iobuf_hdr_t) + ((size_t)1<<(class+IOBUF_MIN_SHIFT));
+	char *mem;
+
+do_map_slab:
+	mem = mmap(NULL, stride*IOBUF_SLAB, PROT_READ|PROT_WRITE,
+		   MAP_PRIVATE|MAP_ANON, -1, 0);
+	if (unlikely(mem == MAP_FAILED)) {
+		if (errno == EINTR)
+			goto do_map_slab;
+
+		return -1;
+	}
+	/* push in reverse, so that we hand out the lowest address first */
+	for (int i=IOBUF_SLAB-1; i>=0; --i) {
+		iobuf_hdr_t *hdr = (iobuf_hdr_t *)(mem + i*stride);
+		hdr->h.class = class;
+		hdr->h.next = iobufs[class];
+		iobufs[class] = hdr;
+	}
+	return 0;
+}
+
+char *iobuf_get(size_t size) {
+	if (unlikely(size > ((size_t)1<<(IOBUF_CLASSES-1+IOBUF_MIN_SHIFT)))) {
+		errno = EINVAL;
+		return NULL;
+	}
+
+	int class = iobuf_class(size);
+	if (iobufs[class] == NULL && map_iobufs(class) < 0)
+		return NULL;
+	
+	iobuf_hdr_t *hdr = iobufs[class];
+	iobufs[class] = hdr->h.next;
+	return (char *)(hdr + 1);
+}
+
+void iobuf_put(char *buf) {
+	iobuf_hdr_t *hdr = ((iobuf_hdr_t *)buf) - 1;
+	BUG_ON(hdr->h.class < 0 || hdr->h.class >= IOBUF_CLASSES);
+	hdr->h.next = iobufs[hdr->h.class];
+	iobufs[hdr->h.class] = hdr;
+}
+
+size_t iobuf_size(const char *buf) {
+	const iobuf_hdr_t *hdr = ((const iobuf_hdr_t *)buf) - 1;
+	return (size_t)1<<(hdr->h.class+IOBUF_MIN_SHIFT);
+}
+
+ssize_t ioctx_read_pooled(ioctx_t *ctx, size_t max, char **out) {
+	ssize_t amt;
+	char *buf;
+
+	*out = NULL;
+try:
+	buf = iobuf_get(max);
+	if (unlikely(buf == NULL))
+		return -1;
+
+	io_syscall(ctx);
+	amt = read(ctx->fd, buf, max);
+	if (amt > 0) {
+		io_read(ctx, amt);
+		io_chain(&ctx->readers);
+		*out = buf;
+		return amt;
+	}
+
+	/* don't hold on to the buffer while we wait */
+	iobuf_put(buf);
+	if (amt == -1) {
+		switch (errno) {
+		case EAGAIN:
+			io_again(ctx);
+			if (unlikely(park_and_iowait(ctx, &ctx->readers) < 0))
+				return -1;
+
+		case EINTR:
+			goto try;
+		}
+	}
+	io_chain(&ctx->readers);
+	return amt;
+}
+
+void ioreader_init(ioreader_t *rd, ioctx_t *ctx, char *buf, size_t cap) {
+	rd->ctx = ctx;
+	rd->buf = buf;
+	rd->cap = cap;
+	rd->start = 0;
+	rd->end = 0;
+	rd->scan = 0;
+}
+
+/* read as much as will fit into the buffer */
+static ssize_t ioreader_fill(ioreader_t *rd) {
+	if (rd->start == rd->end) {
+		rd->start = 0;
+		rd->end = 0;
+	} else if (rd->end == rd->cap && rd->start > 0) {
+		memmove(rd->buf, rd->buf + rd->start, rd->end - rd->start);
+		rd->end -= rd->start;
+		rd->start = 0;
+	}
+	if (unlikely(rd->end == rd->cap)) {
+		errno = ENOBUFS;
+		return -1;
+	}
+
+	ssize_t amt = ioctx_read(rd->ctx, rd->buf + rd->end, rd->cap - rd->end);
+	if (amt > 0)
+		rd->end += amt;
+	
+	return amt;
+}
+
+static ssize_t ioreader_take(ioreader_t *rd, size_t n, char **out) {
+	*out = rd->buf + rd->start;
+	rd->start += n;
+	rd->scan = 0;
+	return n;
+}
+
+ssize_t ioctx_read_until(ioreader_t *rd, const char *delim, size_t dlen, char **out) {
+	ssize_t amt;
+
+	if (unlikely(dlen == 0)) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	for (;;) {
+		const char *base = rd->buf + rd->start;
+		size_t have = rd->end - rd->start;
+		const char *p;
+
+		/* 'scan' bytes have already been ruled out */
+		while ((p = scan_byte(base + rd->scan, have - rd->scan, delim[0])) != NULL) {
+			size_t off = p - base;
+			if (off + dlen > have) {
+				rd->scan = off; /* might be a match; need more data */
+				break;
+			}
+			if (memcmp(p, delim, dlen) == 0)
+				return ioreader_take(rd, off + dlen, out);
+
+			rd->scan = off + 1;
+		}
+		if (p == NULL)
+			rd->scan = have;
+		
+		amt = ioreader_fill(rd);
+		if (amt <= 0)
+			return amt;
+	}
+}
+
+ssize_t ioctx_read_exact(ioreader_t *rd, size_t n, char **out) {
+	ssize_t amt;
+
+	if (unlikely(n > rd->cap)) {
+		errno = EINVAL;
+		return -1;
+	}
+	while (rd->end - rd->start < n) {
+		/* make sure the whole thing fits */
+		if (rd->cap - rd->start < n) {
+			memmove(rd->buf, rd->buf + rd->start, rd->end - rd->start);
+			rd->end -= rd->start;
+			rd->start = 0;
+		}
+		amt = ioreader_fill(rd);
+		if (amt <= 0)
+			return amt;
+	}
+	return ioreader_take(rd, n, out);
+}
+
+ssize_t ioctx_peek(ioreader_t *rd, char **out) {
+	ssize_t amt;
+
+	if (rd->start == rd->end) {
+		amt = ioreader_fill(rd);
+		if (amt <= 0)
+			return amt;
+	}
+	*out = rd->buf + rd->start;
+	return rd->end - rd->start;
+}
+
+/* 
+   Datagrams are moved DGRAM_BATCH at a time. The
+   message headers for a batch live on the task's
+   stack, so the batch is kept small.
+ */
+#define DGRAM_BATCH 8
+
+#ifdef __linux__
+static int dgram_recv_batch(int fd, dgram_t *d, int n) {
+	struct mmsghdr hdr[DGRAM_BATCH];
+	struct iovec iov[DGRAM_BATCH];
+	union {
+		size_t align; /* like struct cmsghdr */
+		char           buf[CMSG_SPACE(sizeof(int))];
+	} cm[DGRAM_BATCH];
+	int res;
+
+	memset(hdr, 0, n*sizeof(hdr[0]));
+	for (int i=0; i<n; ++i) {
+		struct msghdr *m = &hdr[i].msg_hdr;
+		iov[i].iov_base = d[i].buf;
+		iov[i].iov_len = d[i].cap;
+		m->msg_name = &d[i].addr;
+		m->msg_namelen = sizeof(d[i].addr);
+		m->msg_iov = &iov[i];
+		m->msg_iovlen = 1;
+		m->msg_control = cm[i].buf;
+		m->msg_controllen = sizeof(cm[i].buf);
+	}
+	do {
+		res = recvmmsg(fd, hdr, n, 0, NULL);
+	} while (res == -1 && errno == EINTR);
+
+	for (int i=0; i<res; ++i) {
+		struct msghdr *m = &hdr[i].msg_hdr;
+		d[i].len = hdr[i].msg_len;
+		d[i].addrlen = m->msg_namelen;
+		d[i].flags = m->msg_flags;
+		d[i].segsize = 0;
+		for (struct cmsghdr *c = CMSG_FIRSTHDR(m); c != NULL; c = CMSG_NXTHDR(m, c)) {
+			if (c->cmsg_level == IPPROTO_UDP && c->cmsg_type == UDP_GRO) {
+				int seg;
+				memcpy(&seg, CMSG_DATA(c), sizeof(seg));
+				d[i].segsize = seg;
+			}
+		}
+	}
+	return res;
+}
+
+static int dgram_send_batch(int fd, dgram_t *d, int n) {
+	struct mmsghdr hdr[DGRAM_BATCH];
+	struct iovec iov[DGRAM_BATCH];
+	union {
+		size_t align; /* like struct cmsghdr */
+		char           buf[CMSG_SPACE(sizeof(uint16_t))];
+	} cm[DGRAM_BATCH];
+	int res;
+
+	memset(hdr, 0, n*sizeof(hdr[0]));
+	for (int i=0; i<n; ++i) {
+		struct msghdr *m = &hdr[i].msg_hdr;
+		iov[i].iov_base = d[i].buf;
+		iov[i].iov_len = d[i].len;
+		m->msg_name = d[i].addrlen ? &d[i].addr : NULL;
+		m->msg_namelen = d[i].addrlen;
+		m->msg_iov = &iov[i];
+		m->msg_iovlen = 1;
+		if (d[i].segsize) {
+			uint16_t seg = d[i].segsize;
+			m->msg_control = cm[i].buf;
+			m->msg_controllen = sizeof(cm[i].buf);
+			struct cmsghdr *c = CMSG_FIRSTHDR(m);
+			c->cmsg_level = IPPROTO_UDP;
+			c->cmsg_type = UDP_SEGMENT;
+			c->cmsg_len = CMSG_LEN(sizeof(seg));
+			memcpy(CMSG_DATA(c), &seg, sizeof(seg));
+		}
+	}
+	do {
+		res = sendmmsg(fd, hdr, n, 0);
+	} while (res == -1 && errno == EINTR);
+	return res;
+}
+
+int ioctx_udp_gro(ioctx_t *ctx) {
+	int one = 1;
+	return setsockopt(ctx->fd, IPPROTO_UDP, UDP_GRO, &one, sizeof(one));
+}
+#else
+/* one syscall per datagram */
+static int dgram_recv_batch(int fd, dgram_t *d, int n) {
+	int i;
+	for (i=0; i<n; ++i) {
+		ssize_t amt;
+		d[i].addrlen = sizeof(d[i].addr);
+		do {
+			amt = recvfrom(fd, d[i].buf, d[i].cap, 0, (struct sockaddr *)&d[i].addr, &d[i].addrlen);
+		} while (amt == -1 && errno == EINTR);
+		if (amt == -1)
+			break;
+		d[i].len = amt;
+		d[i].flags = 0;
+		d[i].segsize = 0;
+	}
+	return (i == 0) ? -1 : i;
+}
+
+static int dgram_send_batch(int fd, dgram_t *d, int n) {
+	int i;
+	for (i=0; i<n; ++i) {
+		ssize_t amt;
+		if (d[i].segsize) {
+			errno = EOPNOTSUPP;
+			break;
+		}
+		do {
+			amt = sendto(fd, d[i].buf, d[i].len, 0, d[i].addrlen ? (struct sockaddr *)&d[i].addr : NULL, d[i].addrlen);
+		} while (amt == -1 && errno == EINTR);
+		if (amt == -1)
+			break;
+	}
+	return (i == 0) ? -1 : i;
+}
+
+int ioctx_udp_gro(ioctx_t *ctx) {
+	errno = ENOPROTOOPT;
+	return -1;
+}
+#endif
+
+int ioctx_recv_dgrams(ioctx_t *ctx, dgram_t *msgs, int n) {
+	if (unlikely(ctx->fd == -1)) {
+		errno = ECANCELED;
+		return -1;
+	}
+	if (unlikely(n <= 0)) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	int got = 0;
+	while (got < n) {
+		dgram_t *d = msgs+got;
+		int k = (n-got < DGRAM_BATCH) ? n-got : DGRAM_BATCH;
+		unsigned pooled = 0;
+		int res;
+
+		for (int i=0; i<k; ++i) {
+			if (d[i].buf == NULL) {
+				if ((d[i].buf = iobuf_get(d[i].cap)) == NULL) {
+					k = i;
+					break;
+				}
+				pooled |= 1u<<i;
+			}
+		}
+		io_syscall(ctx);
+		res = (k > 0) ? dgram_recv_batch(ctx->fd, d, k) : -1;
+
+		/* don't hold on to buffers that weren't filled */
+		for (int i = (res < 0) ? 0 : res; i<k; ++i) {
+			if (pooled&(1u<<i)) {
+				iobuf_put(d[i].buf);
+				d[i].buf = NULL;
+			}
+		}
+		if (res == -1) {
+			if (errno == EAGAIN && got == 0) {
+				io_again(ctx);
+				if (unlikely(park_and_iowait(ctx, &ctx->readers) < 0))
+					return -1;
+				continue;
+			}
+			if (got)
+				break;
+			return -1;
+		}
+		for (int i=0; i<res; ++i)
+			io_read(ctx, d[i].len);
+		got += res;
+		if (res < k)
+			break;
+	}
+	io_chain(&ctx->readers);
+	return got;
+}
+
+int ioctx_send_dgrams(ioctx_t *ctx, dgram_t *msgs, int n) {
+	if (unlikely(ctx->fd == -1)) {
+		errno = ECANCELED;
+		return -1;
+	}
+
+	int sent = 0;
+	while (sent < n) {
+		int k = (n-sent < DGRAM_BATCH) ? n-sent : DGRAM_BATCH;
+		io_syscall(ctx);
+		int res = dgram_send_batch(ctx->fd, msgs+sent, k);
+		if (res == -1) {
+			if (errno == EAGAIN) {
+				io_again(ctx);
+				if (unlikely(park_and_iowait(ctx, &ctx->writers) < 0))
+					return sent ? sent : -1;
+				continue;
+			}
+			if (sent)
+				break;
+			return -1;
+		}
+		for (int i=0; i<res; ++i)
+			io_wrote(ctx, msgs[sent+i].len);
+		sent += res;
+	}
+	io_chain(&ctx->writers);
+	return sent;
+}
+
+int ioctx_accept(ioctx_t *ctx, struct sockaddr *addr, socklen_t *addrlen) {
+	int res;
+	for (;;) {
+		if (unlikely(codel.overloaded) && shed_pause(ctx) < 0)
+			return -1;
+		io_syscall(ctx);
+		if ((res = accept_nb(ctx->fd, addr, addrlen)) != -1) {
+			if (!shed_close(ctx, res))
+				break;
+			continue;
+		}
+		if (errno != EAGAIN)
+			return -1;
+		io_again(ctx);
+		if (unlikely(park_and_iowait(ctx, &ctx->readers) < 0))
+			return -1;
+	}
+	io_chain(&ctx->readers);
+	return res;
+}
+
+int ioctx_accept_n(ioctx_t *ctx, int *fds, int max) {
+	if (unlikely(max <= 0)) {
+		errno = EINVAL;
+		return -1;
+	}
+	if ((fds[0] = ioctx_accept(ctx, NULL, NULL)) == -1)
+		return -1;
+
+	/* 
+	   Drain the backlog without blocking. Errors other than 
+	   EAGAIN (like EMFILE) are left for the next call to report.
+	 */
+	int n;
+	for (n = 1; n < max; ++n) {
+		if (unlikely(codel.overloaded) && (ctx->flags&IOCTX_SHED_PAUSE))
+			break;
+		io_syscall(ctx);
+		if ((fds[n] = accept_nb(ctx->fd, NULL, NULL)) == -1)
+			break;
+		if (unlikely(shed_close(ctx, fds[n])))
+			--n;
+	}
+	return n;
+}
+
+#define ACCEPT_BATCH 64
+
+int ioctx_accept_spawn(ioctx_t *ctx, int max, void (*start)(word_t)) {
+	int fds[ACCEPT_BATCH];
+	if (max > ACCEPT_BATCH)
+		max = ACCEPT_BATCH;
+
+	int n = ioctx_accept_n(ctx, fds, max);
+	if (n < 0)
+		return -1;
+
+	/* 
+	   We already know every one of these tasks has work
+	   to do, so there's no point deferring allocation
+	   (see spawn_task()); allocate outright unless there
+	   are other spawners in line or we're at the limit.
+	 */
+	for (int i=0; i<n; ++i) {
+		task_t *t = NULL;
+		word_t arg;
+		if (!runq.begin.top && !heap_at_limit())
+			t = new_task();
+		if (t == NULL)
+			t = spawn_task();
+		arg.fd = fds[i];
+		start_task(t, start, arg, 0);
+	}
+	return n;
+}
+
+/* a non-blocking, close-on-exec stream socket */
+static int stream_socket(int family) {
+	int fd;
+#ifdef SOCK_NONBLOCK
+	fd = socket(family, SOCK_STREAM|SOCK_NONBLOCK|SOCK_CLOEXEC, 0);
+#else
+	fd = socket(family, SOCK_STREAM, 0);
+	if (fd == -1)
+		return -1;
+	if (fcntl(fd, F_SETFL, O_NONBLOCK|fcntl(fd, F_GETFL)) == -1 ||
+	    fcntl(fd, F_SETFD, FD_CLOEXEC) == -1) {
+		int err = errno;
+		close(fd);
+		errno = err;
+		return -1;
+	}
+#endif
+	return fd;
+}
+
+int ioctx_listen(ioctx_t *ctx, const struct sockaddr *addr, socklen_t addrlen, int backlog) {
+	int fd, one = 1;
+
+	fd = stream_socket(addr->sa_family);
+	if (fd == -1)
+		return -1;
+	if (setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one)) == -1 ||
+	    setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, &one, sizeof(one)) == -1 ||
+	    bind(fd, addr, addrlen) == -1 ||
+	    listen(fd, backlog) == -1 ||
+	    ioctx_init(fd, ctx) == -1)
+		goto fail;
+
+	return 0;
+fail:
+	one = errno;
+	close(fd);
+	errno = one;
+	return -1;
+}
+
+int ioctx_connect(ioctx_t *ctx, const struct sockaddr *addr, socklen_t addrlen) {
+	int fd, err;
+	socklen_t len = sizeof(err);
+
+	fd = stream_socket(addr->sa_family);
+	if (fd == -1)
+		return -1;
+	if (ioctx_init(fd, ctx) == -1) {
+		err = errno;
+		close(fd);
+		errno = err;
+		return -1;
+	}
+	io_syscall(ctx);
+	if (connect(fd, addr, addrlen) == 0)
+		return 0;
+
+	/* 
+	   An interrupted connect() keeps going in the
+	   background, just like a non-blocking one.
+	   Either way, the socket is writeable once
+	   it has succeeded or failed.
+	 */
+	if ((errno != EINPROGRESS && errno != EINTR) ||
+	    park_and_iowait(ctx, &ctx->writers) < 0 ||
+	    getsockopt(fd, SOL_SOCKET, SO_ERROR, &err, &len) == -1)
+		goto fail;
+	if (err != 0) {
+		errno = err;
+		goto fail;
+	}
+	return 0;
+fail:
+	err = errno;
+	ioctx_destroy(ctx);
+	errno = err;
+	return -1;
+}
+
+/* 
+   Connection pools: each upstream owns 'per' consecutive
+   ioctx slots from the caller's array, with a bitmap of
+   slots holding connections and a bitmap of those that
+   are idle. Tasks that can't get a connection wait on
+   the upstream's tasklist, and are woken one at a time
+   as connections are returned (or connects fail).
+ */
+void connpool_init(connpool_t *pool, upstream_t *ups, int nups, ioctx_t *conns, int per, int max_connecting) {
+	if (per > 64 || per <= 0 || max_connecting <= 0)
+		panic("connpool_init: bad size");
+
+	pool->ups = ups;
+	pool->nups = nups;
+	pool->conns = conns;
+	pool->per = per;
+	pool->max_connecting = max_connecting;
+	memset(ups, 0, nups*sizeof(upstream_t));
+}
+
+static upstream_t *upstream_find(connpool_t *pool, const struct sockaddr *addr, socklen_t addrlen) {
+	upstream_t *free = NULL;
+	if (addrlen > sizeof(struct sockaddr_storage)) {
+		errno = EINVAL;
+		return NULL;
+	}
+	for (int i=0; i<pool->nups; ++i) {
+		upstream_t *up = &pool->ups[i];
+		if (up->addrlen == addrlen && memcmp(&up->addr, addr, addrlen) == 0)
+			return up;
+		if (up->addrlen == 0 && free == NULL)
+			free = up;
+	}
+	if (free == NULL) {
+		errno = ENOSPC;
+		return NULL;
+	}
+	memcpy(&free->addr, addr, addrlen);
+	free->addrlen = addrlen;
+	return free;
+}
+
+/* an idle connection should have nothing to say */
+static int conn_alive(ioctx_t *ctx) {
+	char c;
+	ssize_t amt;
+	do {
+		amt = recv(ctx->fd, &c, 1, MSG_PEEK|MSG_DONTWAIT);
+	} while (amt == -1 && errno == EINTR);
+	return amt == -1 && errno == EAGAIN;
+}
+
+ioctx_t *connpool_get(connpool_t *pool, const struct sockaddr *addr, socklen_t addrlen) {
+	upstream_t *up = upstream_find(pool, addr, addrlen);
+	if (up == NULL)
+		return NULL;
+
+	ioctx_t *conns = pool->conns + (up - pool->ups)*pool->per;
+	uint64_t all = (pool->per == 64) ? ~(uint64_t)0 : ((uint64_t)1<<pool->per)-1;
+	
+	/* first come, first served */
+	if (up->waiters.top || up->woken)
+		goto queue;
+	for (;;) {
+		while (up->idle) {
+			int i = __builtin_ffsll(up->idle)-1;
+			up->idle &= ~((uint64_t)1<<i);
+			if (conn_alive(&conns[i]))
+				return &conns[i];
+
+			ioctx_destroy(&conns[i]);
+			up->used &= ~((uint64_t)1<<i);
+		}
+		if (up->used != all && up->connecting < pool->max_connecting) {
+			int i = __builtin_ffsll(~up->used)-1;
+			up->used |= (uint64_t)1<<i;
+			up->connecting++;
+			int res = ioctx_connect(&conns[i], addr, addrlen);
+			up->connecting--;
+			if (res == 0) {
+				/* tasks may be queued on the connect limit alone */
+				if (up->used != all && wake(&up->waiters))
+					up->woken++;
+				return &conns[i];
+			}
+
+			/* let someone else try */
+			int err = errno;
+			up->used &= ~((uint64_t)1<<i);
+			if (wake(&up->waiters))
+				up->woken++;
+			errno = err;
+			return NULL;
+		}
+	queue:
+		wait(&up->waiters);
+		up->woken--;
+	}
+}
+
+void connpool_put(connpool_t *pool, ioctx_t *conn, int reuse) {
+	int index = conn - pool->conns;
+	upstream_t *up = &pool->ups[index/pool->per];
+	uint64_t bit = (uint64_t)1<<(index%pool->per);
+
+	BUG_ON(!(up->used&bit) || (up->idle&bit));
+	if (conn->cork && ioctx_uncork(conn) < 0)
+		reuse = 0;
+	if (reuse && conn->fd != -1) {
+		up->idle |= bit;
+	} else {
+		if (conn->fd != -1)
+			ioctx_destroy(conn);
+		up->used &= ~bit;
+	}
+	if (wake(&up->waiters))
+		up->woken++;
 }
 
-/* library bootstrap - set main()'s stack as t0 */
+/* runtime bootstrap - set the thread's stack as t0 */
 __attribute__((constructor))
 void chip_init(void) {
 	runq.t0.status = STATUS_RUNNING;
@@ -658,5 +3584,12 @@ void chip_init(void) {
 	 */
 	runq.t0.stack = ((char *)&runq.t0_magic) + sizeof(uintptr_t);
 	runq.t0_magic = stack_magic(&runq.t0);
+	rt.wake = -1;
+	atomic_store(&rt.dog_ms, -1);
+	metrics.ticks0 = ticks();
+	metrics.nsec0 = now_nsec();
+	if (getenv("CHIP_STATS") != NULL)
+		chip_stats_publish();
+	poll_budget(POLL_EVERY, 0, 0);
 	pollinit();
 }
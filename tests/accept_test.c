@@ -0,0 +1,90 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <string.h>
+#include <assert.h>
+#include <chip/chip.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#define please(expr) if ((expr) == -1) { perror(#expr); _exit(1); }
+
+#define CONNS 200
+
+static int handled;
+
+static void handler(word_t arg) {
+	ioctx_t ctx;
+	char buf[16];
+	ssize_t amt;
+
+	please(ioctx_init(arg.fd, &ctx));
+	please(amt = ioctx_read(&ctx, buf, sizeof(buf)));
+	assert(amt == sizeof(int));
+	please(ioctx_write(&ctx, buf, amt));
+	please(ioctx_destroy(&ctx));
+	handled++;
+}
+
+int main(void) {
+	puts("running "__FILE__);
+
+	ioctx_t lctx;
+	struct sockaddr_in addr;
+	socklen_t addrlen = sizeof(addr);
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	please(ioctx_listen(&lctx, (struct sockaddr *)&addr, sizeof(addr), CONNS));
+	please(getsockname(lctx.fd, (struct sockaddr *)&addr, &addrlen));
+
+	/* a whole backlog's worth of connections, each with a request waiting */
+	int clients[CONNS];
+	for (int i=0; i<CONNS; ++i) {
+		please(clients[i] = socket(AF_INET, SOCK_STREAM, 0));
+		please(connect(clients[i], (struct sockaddr *)&addr, sizeof(addr)));
+		assert(write(clients[i], &i, sizeof(i)) == sizeof(i));
+	}
+
+	int fds[8];
+	int n;
+	please(n = ioctx_accept_n(&lctx, fds, 8));
+	assert(n == 8);
+	for (int i=0; i<n; ++i) {
+		word_t arg;
+		arg.fd = fds[i];
+		spawn(handler, arg);
+	}
+
+	int accepted = n, calls = 0;
+	while (accepted < CONNS) {
+		please(n = ioctx_accept_spawn(&lctx, CONNS, handler));
+		accepted += n;
+		calls++;
+	}
+	assert(accepted == CONNS);
+	assert(calls < CONNS/2);
+	while (handled < CONNS)
+		sched();
+
+	for (int i=0; i<CONNS; ++i) {
+		int j;
+		assert(read(clients[i], &j, sizeof(j)) == sizeof(j));
+		assert(i == j);
+		close(clients[i]);
+	}
+
+	/* a backlog of one */
+	please(clients[0] = socket(AF_INET, SOCK_STREAM, 0));
+	please(connect(clients[0], (struct sockaddr *)&addr, sizeof(addr)));
+	please(n = ioctx_accept_n(&lctx, fds, 8));
+	assert(n == 1);
+	close(fds[0]);
+	close(clients[0]);
+
+	please(ioctx_destroy(&lctx));
+	puts(__FILE__ " passed.");
+	return 0;
+}
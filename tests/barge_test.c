@@ -0,0 +1,92 @@
+#include <stdio.h>
+#include <assert.h>
+#include <chip/chip.h>
+
+/*
+ * A task that takes a barging mutex over and over
+ * (yielding while it holds it) mustn't starve the
+ * tasks waiting for the same mutex.
+ */
+#define ITERS   100000
+#define WAITERS 8
+
+static mutex_t mu = MUTEX_BARGING;
+static int hog_iters;
+static int got_at[WAITERS];
+static sema_t done;
+
+/*
+ * Many tasks that each lock repeatedly: the number of
+ * times others take the lock while one task waits for it
+ * is bounded by the tasks ahead of it in line, each of
+ * which can lose it to bargers only so many times.
+ */
+#define LOCKERS 32
+#define ROUNDS  2000
+
+static mutex_t mu2 = MUTEX_BARGING;
+static long acquired;
+static long worst;
+
+static void locker(word_t arg) {
+	for (int i=0; i<ROUNDS; ++i) {
+		long start = acquired;
+		lock(&mu2);
+		if (acquired - start > worst)
+			worst = acquired - start;
+		acquired++;
+		sched();
+		unlock(&mu2);
+	}
+	post(&done);
+}
+
+static void hog(word_t arg) {
+	for (hog_iters=0; hog_iters<ITERS; ++hog_iters) {
+		lock(&mu);
+		if (hog_iters%4 == 0)
+			sched();
+		unlock(&mu);
+	}
+	post(&done);
+}
+
+static void waiter(word_t arg) {
+	lock(&mu);
+	got_at[arg.val] = hog_iters;
+	sched();
+	unlock(&mu);
+	post(&done);
+}
+
+int main(void) {
+	puts("running "__FILE__);
+
+	spawn_budget(WAITERS+2);
+	spawn(hog, NULL_ARG);
+	sched();
+	for (int i=0; i<WAITERS; ++i) {
+		word_t arg;
+		arg.val = i;
+		spawn(waiter, arg);
+	}
+	for (int i=0; i<WAITERS+1; ++i)
+		park(&done);
+
+	for (int i=0; i<WAITERS; ++i)
+		assert(got_at[i] < ITERS/10);
+	assert(!mu.locked && !mu.woken && !mu.starving);
+	assert(mu.waiting.top == NULL);
+
+	spawn_budget(LOCKERS+1);
+	for (int i=0; i<LOCKERS; ++i)
+		spawn(locker, NULL_ARG);
+	for (int i=0; i<LOCKERS; ++i)
+		park(&done);
+	printf("%d lockers: at most %ld others took the lock during one wait\n", LOCKERS, worst);
+	assert(worst <= (long)LOCKERS*(MUTEX_BARGE_LIMIT+1));
+	assert(!mu2.locked && !mu2.woken && !mu2.starving);
+	assert(mu2.waiting.top == NULL && mu2.front.top == NULL);
+	puts(__FILE__ " passed.");
+	return 0;
+}
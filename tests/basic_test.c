@@ -1,4 +1,5 @@
 #include <stdio.h>
+#include <string.h>
 #include <assert.h>
 #include <chip/chip.h>
 
@@ -12,6 +13,25 @@
 static int count;
 static sema_t sema;
 
+/* an argument too big for a word_t */
+typedef struct {
+	int    fd;
+	char   name[32];
+	double deadline;
+} conn_t;
+
+static void check_conn(word_t data) {
+	conn_t *conn = data.ptr;
+	assert(((uintptr_t)conn % sizeof(double)) == 0);
+	assert(conn->fd == 42);
+	assert(strcmp(conn->name, "localhost") == 0);
+	assert(conn->deadline == 1.5);
+
+	/* the copy belongs to this task */
+	conn->fd = -1;
+	post(&sema);
+}
+
 static void inc(word_t data) {
 	if (++count == INCS) {
 		assert(data.val == 0);
@@ -58,6 +78,14 @@ int main(void) {
 	
 	assert(sema.count == 0);
 	assert(count == INCS);
+
+	conn_t conn = { .fd = 42, .name = "localhost", .deadline = 1.5 };
+	spawn_with(check_conn, &conn, sizeof(conn));
+	spawn_with(check_conn, &conn, sizeof(conn));
+	park(&sema);
+	park(&sema);
+	assert(conn.fd == 42);
+
 	puts(__FILE__ " passed.");
 	return 0;
 }
@@ -0,0 +1,98 @@
+#include <stdio.h>
+#include <assert.h>
+#include <chip/chip.h>
+
+#define WAITERS 1000
+#define ITEMS   10000
+
+static mutex_t mu;
+static cond_t cv;
+static int go;
+static int inside;
+static int finished;
+static sema_t done;
+
+static void waiter(word_t arg) {
+	lock(&mu);
+	while (!go)
+		cond_wait(&cv, &mu);
+	assert(++inside == 1);
+	sched(); /* nobody else may get in meanwhile */
+	--inside;
+	finished++;
+	unlock(&mu);
+	post(&done);
+}
+
+/* a bounded queue, with a barging mutex */
+static mutex_t qmu = MUTEX_BARGING;
+static cond_t nonempty, nonfull;
+static int queue[4], qlen, qhead;
+static long sum;
+
+static void producer(word_t arg) {
+	for (int i=1; i<=ITEMS; ++i) {
+		lock(&qmu);
+		while (qlen == 4)
+			cond_wait(&nonfull, &qmu);
+		queue[(qhead+qlen++)%4] = i;
+		cond_signal(&nonempty);
+		unlock(&qmu);
+	}
+	post(&done);
+}
+
+static void consumer(word_t arg) {
+	for (int i=0; i<ITEMS/2; ++i) {
+		lock(&qmu);
+		while (qlen == 0)
+			cond_wait(&nonempty, &qmu);
+		sum += queue[qhead];
+		qhead = (qhead+1)%4;
+		qlen--;
+		cond_signal(&nonfull);
+		unlock(&qmu);
+	}
+	post(&done);
+}
+
+int main(void) {
+	puts("running "__FILE__);
+	sched_stats_start(); /* for the switch counts */
+
+	spawn_budget(WAITERS+1);
+	for (int i=0; i<WAITERS; ++i)
+		spawn(waiter, NULL_ARG);
+	sched();
+
+	/* broadcast without holding the mutex */
+	sched_stats_t before, after;
+	get_sched_stats(&before);
+	go = 1;
+	cond_broadcast(&cv);
+	for (int i=0; i<WAITERS; ++i)
+		park(&done);
+	get_sched_stats(&after);
+	assert(finished == WAITERS);
+	assert(cv.waiting.top == NULL && mu.waiting.top == NULL && !mu.locked);
+
+	/*
+	 * Three switches per waiter: it runs, its sched() comes
+	 * straight back, and main runs for the post(). Waking all
+	 * of them at once would add a trip to the mutex for each.
+	 */
+	uint64_t switches = after.runq_delay.count - before.runq_delay.count;
+	assert(switches <= 3*WAITERS + 10);
+
+	/* signal, with the mutex held */
+	spawn(producer, NULL_ARG);
+	spawn(consumer, NULL_ARG);
+	spawn(consumer, NULL_ARG);
+	for (int i=0; i<3; ++i)
+		park(&done);
+	assert(sum == (long)ITEMS*(ITEMS+1)/2);
+	assert(qmu.waiting.top == NULL && !qmu.locked);
+
+	puts(__FILE__ " passed.");
+	return 0;
+}
@@ -0,0 +1,151 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <string.h>
+#include <assert.h>
+#include <chip/chip.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#define please(expr) if ((expr) == -1) { perror(#expr); _exit(1); }
+
+#define CLIENTS 16
+#define ROUNDS  50
+#define PER     4
+
+static ioctx_t lctx;
+static struct sockaddr_in addr;
+static int accepted;
+static int served;
+static sema_t done;
+static sema_t closed;
+
+static connpool_t pool;
+static upstream_t ups[2];
+static ioctx_t conns[2*PER];
+
+#define GREEDY 3
+
+static connpool_t pool1;
+static upstream_t ups1[1];
+static ioctx_t conns1[2*GREEDY];
+static sema_t greedy_done;
+
+/* echoes 4-byte requests; "bye!" closes the connection */
+static void server(word_t arg) {
+	ioctx_t ctx;
+	char buf[4];
+	int bye = 0;
+
+	accepted++;
+	please(ioctx_init(arg.fd, &ctx));
+	while (!bye) {
+		ssize_t amt = ioctx_read(&ctx, buf, sizeof(buf));
+		if (amt <= 0)
+			break;
+		assert(amt == sizeof(buf));
+		bye = memcmp(buf, "bye!", 4) == 0;
+		assert(ioctx_write(&ctx, buf, amt) == amt);
+	}
+	please(ioctx_destroy(&ctx));
+	if (bye)
+		post(&closed);
+}
+
+static void acceptor(word_t arg) {
+	while (ioctx_accept_spawn(&lctx, 16, server) > 0) ;
+	assert(errno == ECANCELED);
+}
+
+static void request(const char *msg) {
+	char buf[4];
+	ioctx_t *conn = connpool_get(&pool, (struct sockaddr *)&addr, sizeof(addr));
+	assert(conn != NULL);
+	assert(ioctx_write(conn, (char *)msg, 4) == 4);
+	assert(ioctx_read(conn, buf, 4) == 4);
+	assert(memcmp(buf, msg, 4) == 0);
+	connpool_put(&pool, conn, 1);
+}
+
+static void client(word_t arg) {
+	for (int i=0; i<ROUNDS; ++i)
+		request("ping");
+	if (++served == CLIENTS)
+		post(&done);
+}
+
+/* holds one connection while it asks for another */
+static void greedy(word_t arg) {
+	ioctx_t *c[2];
+	char buf[4];
+	for (int i=0; i<2; ++i)
+		assert((c[i] = connpool_get(&pool1, (struct sockaddr *)&addr, sizeof(addr))) != NULL);
+	for (int i=0; i<2; ++i) {
+		assert(ioctx_write(c[i], "ping", 4) == 4);
+		assert(ioctx_read(c[i], buf, 4) == 4);
+	}
+	for (int i=0; i<2; ++i)
+		connpool_put(&pool1, c[i], 1);
+	post(&greedy_done);
+}
+
+int main(void) {
+	puts("running "__FILE__);
+
+	socklen_t len = sizeof(addr);
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+	/* nobody listening */
+	ioctx_t ctx;
+	please(ioctx_listen(&ctx, (struct sockaddr *)&addr, sizeof(addr), 1));
+	please(getsockname(ctx.fd, (struct sockaddr *)&addr, &len));
+	please(ioctx_destroy(&ctx));
+	assert(ioctx_connect(&ctx, (struct sockaddr *)&addr, sizeof(addr)) == -1);
+	assert(errno == ECONNREFUSED);
+
+	addr.sin_port = 0;
+	please(ioctx_listen(&lctx, (struct sockaddr *)&addr, sizeof(addr), 64));
+	please(getsockname(lctx.fd, (struct sockaddr *)&addr, &len));
+	word_t arg;
+	arg.ptr = NULL;
+	spawn(acceptor, arg);
+
+	/* many tasks share a handful of connections */
+	connpool_init(&pool, ups, 2, conns, PER, 2);
+	for (int i=0; i<CLIENTS; ++i)
+		spawn(client, arg);
+	park(&done);
+	assert(accepted > 0 && accepted <= PER);
+
+	/* connections that the peer closed aren't handed out */
+	ioctx_t *c[PER];
+	char buf[4];
+	int before;
+	for (int i=0; i<PER; ++i)
+		assert((c[i] = connpool_get(&pool, (struct sockaddr *)&addr, sizeof(addr))) != NULL);
+	for (int i=0; i<PER; ++i) {
+		assert(ioctx_write(c[i], "bye!", 4) == 4);
+		assert(ioctx_read(c[i], buf, 4) == 4);
+		connpool_put(&pool, c[i], 1);
+	}
+	for (int i=0; i<PER; ++i)
+		park(&closed);
+	before = accepted;
+	request("ping");
+	assert(accepted > before);
+
+	/* one connect at a time doesn't hold up tasks when slots are free */
+	connpool_init(&pool1, ups1, 1, conns1, 2*GREEDY, 1);
+	for (int i=0; i<GREEDY; ++i)
+		spawn(greedy, arg);
+	for (int i=0; i<GREEDY; ++i)
+		park(&greedy_done);
+
+	please(ioctx_destroy(&lctx));
+	puts(__FILE__ " passed.");
+	return 0;
+}
@@ -0,0 +1,138 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <string.h>
+#include <assert.h>
+#include <chip/chip.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <sys/socket.h>
+
+#define please(expr) if ((expr) == -1) { perror(#expr); _exit(1); }
+
+#define BULK (1<<20)
+
+static int sv[2];
+static sema_t ready;
+static sema_t gate;
+static sema_t done;
+
+/* replier exits corked, so these have to outlive it */
+static iocork_t rcork;
+static char rbuf[64];
+
+/* nothing may reach the peer until we give up the CPU */
+static void assert_empty(void) {
+	char c;
+	assert(recv(sv[1], &c, 1, MSG_DONTWAIT) == -1 && errno == EAGAIN);
+}
+
+static void expect(const char *str) {
+	char buf[256];
+	size_t len = strlen(str);
+	assert(read(sv[1], buf, sizeof(buf)) == (ssize_t)len);
+	assert(memcmp(buf, str, len) == 0);
+}
+
+static void replier(word_t arg) {
+	ioctx_t *ctx = arg.ptr;
+	char big[100];
+
+	ioctx_cork(ctx, &rcork, rbuf, sizeof(rbuf));
+	please(ioctx_write(ctx, "a", 1));
+	please(ioctx_write(ctx, "b", 1));
+	please(ioctx_write(ctx, "c", 1));
+	assert_empty();
+
+	/* blocking flushes */
+	post(&ready);
+	park(&gate);
+
+	/* overflowing the buffer writes both at once */
+	memset(big, 'y', sizeof(big));
+	please(ioctx_write(ctx, big, 40));
+	assert_empty();
+	assert(ioctx_write(ctx, big, sizeof(big)) == sizeof(big));
+	char in[256];
+	assert(read(sv[1], in, sizeof(in)) == 140);
+
+	please(ioctx_write(ctx, "f", 1));
+	assert_empty();
+	please(ioctx_flush(ctx));
+	expect("f");
+
+	/* exiting flushes */
+	please(ioctx_write(ctx, "tail", 4));
+	post(&done);
+}
+
+static void bulk_reader(word_t arg) {
+	ioctx_t ctx;
+	char buf[4096];
+	size_t total = 0;
+	unsigned char next = 0;
+	ssize_t amt;
+
+	please(ioctx_init(arg.fd, &ctx));
+	while (total < BULK) {
+		please(amt = ioctx_read(&ctx, buf, sizeof(buf)));
+		assert(amt > 0);
+		for (ssize_t i=0; i<amt; ++i)
+			assert((unsigned char)buf[i] == next++);
+		total += amt;
+	}
+	please(ioctx_destroy(&ctx));
+	post(&done);
+}
+
+int main(void) {
+	puts("running "__FILE__);
+
+	please(socketpair(AF_UNIX, SOCK_STREAM, 0, sv));
+	fcntl(sv[0], F_SETFL, O_NONBLOCK|(fcntl(sv[0], F_GETFL)));
+	fcntl(sv[1], F_SETFL, O_NONBLOCK|(fcntl(sv[1], F_GETFL)));
+
+	ioctx_t ctx;
+	please(ioctx_init(sv[0], &ctx));
+
+	word_t arg;
+	arg.ptr = &ctx;
+	spawn(replier, arg);
+	park(&ready);
+	expect("abc");
+	post(&gate);
+	park(&done);
+	expect("tail");
+	please(ioctx_uncork(&ctx));
+
+	/*
+	   stream more than the socket buffer holds through a
+	   small cork, so that both the writer and the
+	   background flush run into EAGAIN
+	 */
+	arg.fd = sv[1];
+	spawn(bulk_reader, arg);
+
+	iocork_t cork;
+	char cbuf[1000];
+	unsigned char next = 0;
+	ioctx_cork(&ctx, &cork, cbuf, sizeof(cbuf));
+	for (size_t sent = 0; sent < BULK; ) {
+		char msg[97];
+		size_t n = BULK-sent < sizeof(msg) ? BULK-sent : sizeof(msg);
+		for (size_t i=0; i<n; ++i)
+			msg[i] = (char)next++;
+
+		size_t off = 0;
+		while (off < n) {
+			ssize_t amt;
+			please(amt = ioctx_write(&ctx, msg+off, n-off));
+			off += amt;
+		}
+		sent += n;
+	}
+	park(&done);
+	please(ioctx_destroy(&ctx));
+	puts(__FILE__ " passed.");
+	return 0;
+}
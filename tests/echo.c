@@ -11,18 +11,18 @@
 
 #define please(expr) if ((expr) == -1) { perror(#expr); _exit(1); }
 
-/* we have 12kB stacks, so this should fit fine. */
-#define STACK_BUF_SIZE 8192
+/* taken from the buffer pool only while data is in flight */
+#define BUF_SIZE 8192
 
 void echo(word_t arg0) {
 	ioctx_t ctx;
-	char buf[STACK_BUF_SIZE];
+	char *buf;
 
 	please(ioctx_init(arg0.fd, &ctx));
 
 	for (;;) {
 		ssize_t ret;
-		ssize_t res = ioctx_read(&ctx, buf, STACK_BUF_SIZE);
+		ssize_t res = ioctx_read_pooled(&ctx, BUF_SIZE, &buf);
 		switch (res) {
 		case -1:
 			perror("read");
@@ -36,11 +36,13 @@ void echo(word_t arg0) {
 				case -1:
 					perror("write");
 				case 0:
+					iobuf_put(buf);
 					goto done;
 				default:
 					ret += w;
 				}
 			}
+			iobuf_put(buf);
 		}
 	}
 
@@ -53,8 +55,6 @@ done:
 int main(void) {
 	int lfd;
 	ioctx_t lctx;
-	struct sockaddr addr;
-	socklen_t addrlen;
 
 #ifdef __linux__
 	please(lfd = socket(AF_INET, SOCK_STREAM|SOCK_NONBLOCK|SOCK_CLOEXEC, 0));
@@ -74,9 +74,6 @@ int main(void) {
 
 	please(listen(lfd, 128));
 	printf("listening on :%d...\n", PORT);
-	for (;;) {
-		word_t arg;
-		please(arg.fd = ioctx_accept(&lctx, &addr, &addrlen));
-		spawn(echo, arg);
-	}
+	for (;;)
+		please(ioctx_accept_spawn(&lctx, 64, echo));
 }
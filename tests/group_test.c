@@ -0,0 +1,95 @@
+#include <stdio.h>
+#include <assert.h>
+#include <errno.h>
+#include <chip/chip.h>
+
+#define MEMBERS 100
+
+static word_t square(word_t arg) {
+	word_t out;
+	sched();
+	out.val = arg.val * arg.val;
+	return out;
+}
+
+/* fork-join recursion: every call joins its own group */
+static word_t fib(word_t arg) {
+	word_t out;
+	if (arg.val < 2)
+		return arg;
+
+	group_t g;
+	word_t res[2];
+	word_t a, b;
+	a.val = arg.val-1;
+	b.val = arg.val-2;
+	group_init(&g, res, 2);
+	assert(group_spawn(&g, fib, a) == 0);
+	assert(group_spawn(&g, fib, b) == 1);
+	assert(group_join(&g) == 2);
+	out.val = res[0].val + res[1].val;
+	return out;
+}
+
+static int ran;
+
+static word_t never(word_t arg) {
+	ran++;
+	return arg;
+}
+
+static word_t quick(word_t arg) {
+	return arg;
+}
+
+static void bystander(word_t arg) {
+	ran++;
+}
+
+int main(void) {
+	puts("running "__FILE__);
+
+	group_t g;
+	word_t res[MEMBERS];
+	group_init(&g, res, MEMBERS);
+	for (int i=0; i<MEMBERS; ++i) {
+		word_t arg;
+		arg.val = i;
+		assert(group_spawn(&g, square, arg) == i);
+	}
+	assert(group_spawn(&g, square, NULL_ARG) == -1 && errno == ENOSPC);
+	assert(group_join(&g) == MEMBERS);
+	for (int i=0; i<MEMBERS; ++i)
+		assert(res[i].val == (uintptr_t)(i*i));
+	/* joining again doesn't block */
+	assert(group_join(&g) == MEMBERS);
+
+	word_t n;
+	n.val = 15;
+	spawn_budget(64);
+	assert(fib(n).val == 610);
+
+	/* members that haven't started don't run */
+	group_init(&g, res, MEMBERS);
+	for (int i=0; i<10; ++i)
+		group_spawn(&g, never, NULL_ARG);
+	group_cancel(&g);
+	assert(group_spawn(&g, never, NULL_ARG) == -1 && errno == ECANCELED);
+	assert(group_join(&g) == 0);
+	assert(ran == 0);
+
+	/* the last member hands off to the joiner, ahead of the run queue */
+	group_init(&g, NULL, 0);
+	group_spawn(&g, quick, NULL_ARG);
+	spawn(bystander, NULL_ARG);
+	assert(group_join(&g) == 1);
+	assert(ran == 0);
+	sched();
+	assert(ran == 1);
+
+	tsk_stats_t stats;
+	get_tsk_stats(&stats);
+	assert(stats.parked == 0 && stats.runnable == 0);
+	puts(__FILE__ " passed.");
+	return 0;
+}
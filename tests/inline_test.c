@@ -0,0 +1,116 @@
+#include <stdio.h>
+#include <assert.h>
+#include <chip/chip.h>
+
+/*
+ * queue many inline calls, a few of
+ * which block, and make sure every one
+ * of them runs to completion.
+ */
+#define INCS     100000
+#define BLOCKERS 10
+
+static int count;
+static int blocked;
+static sema_t sema;
+static sema_t gate;
+
+#define LIMIT   4
+#define LIMITED 20
+
+static int ran;
+
+static void blocker(word_t data) {
+	++blocked;
+	park(&gate);
+	--blocked;
+	++ran;
+}
+
+static void inc(word_t data) {
+	if (data.val % (INCS/BLOCKERS) == 0) {
+		/* this should get its own stack */
+		++blocked;
+		park(&gate);
+		--blocked;
+	}
+	if (++count == INCS)
+		post(&sema);
+}
+
+static int stranded_ran;
+static sema_t gate2;
+
+static void quick(word_t data) {
+	for (int i=0; i<3; ++i)
+		sched();
+}
+
+static void held(word_t data) {
+	park(&gate2);
+}
+
+static void stranded(word_t data) {
+	stranded_ran = 1;
+}
+
+static void release(word_t data) {
+	post(&gate2);
+}
+
+int main(void) {
+	puts("running "__FILE__);
+
+	for (int i=0; i<INCS; ++i) {
+		word_t arg;
+		arg.val = i;
+		spawn_inline(inc, arg);
+	}
+
+	/* let everything but the blockers finish */
+	while (count < INCS-BLOCKERS)
+		sched();
+
+	assert(blocked == BLOCKERS);
+	tsk_stats_t stats;
+	get_tsk_stats(&stats);
+	printf("with %d blocked calls, %d parked, %d free, %d runnable\n", blocked, stats.parked, stats.free, stats.runnable);
+
+	for (int i=0; i<BLOCKERS; ++i)
+		post(&gate);
+
+	park(&sema);
+	assert(count == INCS);
+	assert(blocked == 0);
+
+	/* nothing is left parked once the queue drains */
+	sched();
+	get_tsk_stats(&stats);
+	assert(stats.parked == 0);
+
+	/* blocked calls can't take more stacks than the limit allows */
+	heap_stats_t hs;
+	spawn_limit(LIMIT);
+	for (int i=0; i<LIMITED; ++i)
+		spawn_inline(blocker, NULL_ARG);
+	while (ran < LIMITED) {
+		for (int i=0; i<10; ++i)
+			sched();
+		get_heap_stats(&hs);
+		assert(hs.live <= LIMIT);
+		assert(blocked > 0 && blocked <= LIMIT);
+		post(&gate);
+		sched();
+	}
+	assert(blocked == 0);
+
+	/* queued calls get a stack that frees up before a waiting spawner does */
+	spawn_limit(2);
+	spawn(quick, NULL_ARG);
+	spawn(held, NULL_ARG);
+	spawn_inline(stranded, NULL_ARG);
+	spawn(release, NULL_ARG); /* waits for quick() to exit */
+	assert(stranded_ran);
+	puts(__FILE__ " passed.");
+	return 0;
+}
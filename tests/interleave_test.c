@@ -0,0 +1,94 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <assert.h>
+#include <chip/chip.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+
+#define please(expr) if ((expr) == -1) { perror(#expr); _exit(1); }
+
+/*
+ * I/O readiness has to be noticed even though
+ * the run queue never empties
+ */
+
+#define SPINNERS 4
+
+static ioctx_t rctx;
+static int wfd;
+static int stop;
+static long spins;
+static long woke_at; /* spins when the reader got its data */
+static sema_t done;
+
+static void spinner(word_t arg) {
+	while (!stop) {
+		spins++;
+		sched();
+	}
+	post(&done);
+}
+
+static void reader(word_t arg) {
+	char c;
+	assert(ioctx_read(&rctx, &c, 1) == 1);
+	woke_at = spins;
+	post(&done);
+}
+
+/* returns the spins between the write and the reader waking up */
+static long round_trip(void) {
+	word_t arg;
+	arg.ptr = NULL;
+	woke_at = -1;
+	spawn(reader, arg);
+	while (spins < 100)
+		sched();
+
+	long before = spins;
+	assert(write(wfd, "x", 1) == 1);
+	while (woke_at == -1) {
+		sched();
+		assert(spins - before < 100000);
+	}
+	park(&done);
+	return woke_at - before;
+}
+
+int main(void) {
+	puts("running "__FILE__);
+
+	int pipefd[2];
+	please(pipe(pipefd));
+	fcntl(pipefd[0], F_SETFL, O_NONBLOCK|(fcntl(pipefd[0], F_GETFL)));
+	please(ioctx_init(pipefd[0], &rctx));
+	wfd = pipefd[1];
+
+	word_t arg;
+	arg.ptr = NULL;
+	spawn_budget(SPINNERS+2);
+	for (int i=0; i<SPINNERS; ++i)
+		spawn(spinner, arg);
+
+	/* the default budget */
+	round_trip();
+
+	/* time-based only */
+	poll_budget(0, 100, 0);
+	spins = 0;
+	round_trip();
+
+	/* woken tasks cut in line */
+	poll_budget(8, 0, 1);
+	spins = 0;
+	assert(round_trip() <= 8);
+
+	stop = 1;
+	for (int i=0; i<SPINNERS; ++i)
+		park(&done);
+
+	please(ioctx_destroy(&rctx));
+	puts(__FILE__ " passed.");
+	return 0;
+}
@@ -0,0 +1,80 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <string.h>
+#include <assert.h>
+#include <chip/chip.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+
+#define please(expr) if ((expr) == -1) { perror(#expr); _exit(1); }
+
+#define MSGS 1000
+#define SIZE 8192
+
+static sema_t done;
+
+static void reader(word_t arg) {
+	ioctx_t ctx;
+	char *buf;
+	ssize_t amt;
+	size_t total = 0;
+	unsigned char next = 0;
+
+	please(ioctx_init(arg.fd, &ctx));
+	for (;;) {
+		please(amt = ioctx_read_pooled(&ctx, SIZE, &buf));
+		if (amt == 0) {
+			assert(buf == NULL);
+			break;
+		}
+		assert(iobuf_size(buf) >= SIZE);
+		for (ssize_t i=0; i<amt; ++i)
+			assert((unsigned char)buf[i] == next++);
+		
+		total += amt;
+		iobuf_put(buf);
+	}
+	assert(total == MSGS*100);
+	please(ioctx_destroy(&ctx));
+	post(&done);
+}
+
+int main(void) {
+	puts("running "__FILE__);
+
+	/* buffers are recycled LIFO */
+	char *a = iobuf_get(1000);
+	assert(a != NULL);
+	assert(iobuf_size(a) == 1024);
+	iobuf_put(a);
+	assert(iobuf_get(1024) == a);
+	iobuf_put(a);
+	assert(iobuf_get(1<<20) == NULL && errno == EINVAL);
+
+	int pipefd[2];
+	please(pipe(pipefd));
+	fcntl(pipefd[0], F_SETFL, O_NONBLOCK|(fcntl(pipefd[0], F_GETFL)));
+	fcntl(pipefd[1], F_SETFL, O_NONBLOCK|(fcntl(pipefd[1], F_GETFL)));
+
+	ioctx_t wctx;
+	word_t arg;
+	arg.fd = pipefd[0];
+	spawn(reader, arg);
+	please(ioctx_init(pipefd[1], &wctx));
+
+	unsigned char next = 0;
+	for (int i=0; i<MSGS; ++i) {
+		char msg[100];
+		for (int j=0; j<100; ++j)
+			msg[j] = (char)next++;
+		
+		/* let the reader block (without a buffer) */
+		sched();
+		please(ioctx_write(&wctx, msg, sizeof(msg)));
+	}
+	please(ioctx_destroy(&wctx));
+	park(&done);
+	puts(__FILE__ " passed.");
+	return 0;
+}
@@ -0,0 +1,71 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <assert.h>
+#include <chip/chip.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+
+#define please(expr) if ((expr) == -1) { perror(#expr); _exit(1); }
+
+static ioctx_t rctx, wctx;
+static ioctx_stats_t rst, wst;
+static sema_t done;
+
+static void reader(word_t arg) {
+	char buf[64];
+	assert(ioctx_read(&rctx, buf, sizeof(buf)) == 5);
+	post(&done);
+}
+
+static int tracked(void) {
+	int n = 0;
+	for (ioctx_stats_t *s = ioctx_tracked(NULL); s != NULL; s = ioctx_tracked(s))
+		n++;
+	return n;
+}
+
+int main(void) {
+	puts("running "__FILE__);
+
+	int pipefd[2];
+	please(pipe(pipefd));
+	fcntl(pipefd[0], F_SETFL, O_NONBLOCK|(fcntl(pipefd[0], F_GETFL)));
+	fcntl(pipefd[1], F_SETFL, O_NONBLOCK|(fcntl(pipefd[1], F_GETFL)));
+	please(ioctx_init(pipefd[0], &rctx));
+	please(ioctx_init(pipefd[1], &wctx));
+
+	assert(tracked() == 0);
+	ioctx_track(&rctx, &rst);
+	ioctx_track(&wctx, &wst);
+	assert(tracked() == 2);
+	assert(ioctx_tracked(NULL) == &wst);
+
+	/* the reader blocks, then gets woken by the poller */
+	word_t arg;
+	arg.ptr = NULL;
+	spawn(reader, arg);
+	sched();
+	assert(rst.syscalls == 1 && rst.eagain == 1 && rst.parks == 1);
+	assert(ioctx_write(&wctx, "hello", 5) == 5);
+	park(&done);
+	assert(rst.syscalls == 2);
+	assert(rst.rbytes == 5);
+	assert(rst.events >= 1);
+	assert(rst.iowait > 0);
+
+	assert(wst.syscalls == 1 && wst.wbytes == 5);
+	assert(wst.eagain == 0 && wst.parks == 0);
+	assert(rst.wbytes == 0 && wst.rbytes == 0);
+
+	/* destroying an ioctx stops tracking it */
+	please(ioctx_destroy(&rctx));
+	assert(rst.ctx == NULL);
+	assert(tracked() == 1);
+	assert(ioctx_tracked(NULL) == &wst);
+	please(ioctx_destroy(&wctx));
+	assert(tracked() == 0);
+
+	puts(__FILE__ " passed.");
+	return 0;
+}
@@ -0,0 +1,88 @@
+#include <stdio.h>
+#include <errno.h>
+#include <assert.h>
+#include <chip/chip.h>
+
+/*
+ * spawn many more tasks than the
+ * task limit allows, and check that
+ * the limit is never exceeded.
+ */
+#define INCS  3000
+#define LIMIT 8
+
+static int count;
+static sema_t done;
+static sema_t gate;
+
+static void inc(word_t data) {
+	sched();
+	if (++count == INCS)
+		post(&done);
+}
+
+static void gated(word_t data) {
+	park(&gate);
+	if (++count == LIMIT)
+		post(&done);
+}
+
+static sema_t later;
+
+static void deferred(word_t data) {
+	post(&later);
+}
+
+/* with budget 0, this spawn waits in line while main is runnable */
+static void deferrer(word_t data) {
+	spawn(deferred, NULL_ARG);
+}
+
+int main(void) {
+	puts("running "__FILE__);
+
+	heap_stats_t hs;
+	spawn_limit(LIMIT);
+	spawn_budget(INCS); /* hit the limit, not the budget */
+
+	for (int i=0; i<INCS; ++i) {
+		spawn(inc, NULL_ARG);
+	}
+	park(&done);
+
+	get_heap_stats(&hs);
+	printf("after %d spawns, highwater %d, denied %lu\n", INCS, hs.highwater, hs.denied);
+	assert(hs.highwater <= LIMIT);
+	assert(hs.denied > 0);
+	assert(hs.limit == LIMIT);
+
+	/* fill the heap with tasks that can't exit yet */
+	count = 0;
+	for (int i=0; i<LIMIT; ++i)
+		assert(try_spawn(gated, NULL_ARG) == 0);
+	
+	assert(try_spawn(gated, NULL_ARG) == -1);
+	assert(errno == EAGAIN);
+	get_heap_stats(&hs);
+	assert(hs.live == LIMIT);
+
+	for (int i=0; i<LIMIT; ++i)
+		post(&gate);
+	park(&done);
+
+	tsk_stats_t stats;
+	get_tsk_stats(&stats);
+	assert(stats.parked == 0);
+	assert(stats.runnable == 0);
+
+	/* try_spawn() doesn't jump the line of waiting spawners */
+	spawn_limit(0);
+	spawn_budget(0);
+	spawn(deferrer, NULL_ARG);
+	sched();
+	assert(try_spawn(deferred, NULL_ARG) == -1);
+	assert(errno == EAGAIN);
+	park(&later);
+	puts(__FILE__ " passed.");
+	return 0;
+}
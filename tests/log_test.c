@@ -0,0 +1,106 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <string.h>
+#include <assert.h>
+#include <chip/chip.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+
+#define please(expr) if ((expr) == -1) { perror(#expr); _exit(1); }
+
+#define FLOOD 2000
+
+static ioctx_t rctx, wctx;
+static char got[1<<20];
+static size_t nread;
+
+static void reader(word_t arg) {
+	ssize_t amt;
+	while ((amt = ioctx_read(&rctx, got+nread, sizeof(got)-1-nread)) > 0)
+		nread += amt;
+}
+
+/* waits for the reader to catch up with 'line' */
+static void expect(const char *line) {
+	for (int i=0; i<100000 && strstr(got, line) == NULL; ++i)
+		sched();
+	if (strstr(got, line) == NULL) {
+		fprintf(stderr, "missing \"%s\" in:\n%s", line, got);
+		_exit(1);
+	}
+}
+
+int main(void) {
+	puts("running "__FILE__);
+
+	int pipefd[2];
+	please(pipe(pipefd));
+	fcntl(pipefd[0], F_SETFL, O_NONBLOCK|(fcntl(pipefd[0], F_GETFL)));
+	fcntl(pipefd[1], F_SETFL, O_NONBLOCK|(fcntl(pipefd[1], F_GETFL)));
+	please(ioctx_init(pipefd[0], &rctx));
+	please(ioctx_init(pipefd[1], &wctx));
+
+	word_t arg;
+	arg.ptr = NULL;
+	spawn(reader, arg);
+
+	/* not open yet: ignored */
+	chip_log("lost");
+
+	please(chip_log_open(&wctx));
+	assert(chip_log_open(&wctx) == -1 && errno == EBUSY);
+
+	chip_log("ints %d %i %u %x %c %%", -5, 12, 7u, 255u, 'z');
+	chip_log("longs %ld %lld %zu %lx", -1L, 1LL<<40, (size_t)42, 0xabcdefUL);
+	chip_log("sizes %zd %zu %zx %d", (ssize_t)-3, (size_t)-1, (size_t)0x1f, 9);
+	chip_log("str <%s> <%s>", "abc", "");
+	chip_log_bytes("raw bytes\n", 10);
+	chip_log("last\n");
+	chip_log_flush();
+
+	expect("ints -5 12 7 ff z %\n");
+	expect("longs -1 1099511627776 42 abcdef\n");
+	if (sizeof(size_t) == 8)
+		expect("sizes -3 18446744073709551615 1f 9\n");
+	else
+		expect("sizes -3 4294967295 1f 9\n");
+	expect("str <abc> <>\n");
+	expect("raw bytes\n");
+	expect("last\n");
+	assert(strstr(got, "lost") == NULL);
+	assert(chip_log_dropped() == 0);
+
+	/* long strings are truncated, not overrun */
+	char big[300];
+	memset(big, 'q', sizeof(big)-1);
+	big[sizeof(big)-1] = 0;
+	chip_log("big %s %d", big, 1);
+	chip_log_flush();
+	expect("big qqqq");
+
+	/* without yielding, the ring overflows */
+	for (int i=0; i<FLOOD; ++i)
+		chip_log("flood %d", i);
+	uint64_t dropped = chip_log_dropped();
+	assert(dropped > 0 && dropped < FLOOD);
+	chip_log_flush();
+	char line[64];
+	snprintf(line, sizeof(line), "chip_log: dropped %llu records\n", (unsigned long long)dropped);
+	expect(line);
+	expect("flood 0\n");
+	assert(strstr(got, "flood 1999\n") == NULL);
+
+	chip_log_close();
+	chip_log("after close");
+	please(chip_log_open(&wctx));
+	chip_log("reopened");
+	chip_log_close();
+	expect("reopened\n");
+	assert(strstr(got, "after close") == NULL);
+
+	please(ioctx_destroy(&wctx));
+	please(ioctx_destroy(&rctx));
+	puts(__FILE__ " passed.");
+	return 0;
+}
@@ -0,0 +1,61 @@
+#include <stdio.h>
+#include <time.h>
+#include <assert.h>
+#include <chip/chip.h>
+
+/*
+ * TASKS tasks each take a shared lock ITERS
+ * times. Every fourth critical section yields
+ * while holding the lock (as if it were waiting
+ * on I/O), so the lock is usually contended.
+ */
+#define TASKS 16
+#define ITERS 250000
+
+static mutex_t mu;
+static long count;
+static sema_t done;
+
+static void worker(word_t arg) {
+	for (int i=0; i<ITERS; ++i) {
+		lock(&mu);
+		count++;
+		if (i%4 == 0)
+			sched();
+		unlock(&mu);
+	}
+	post(&done);
+}
+
+static void bench(const char *name, int barging) {
+	mutex_t init = MUTEX_BARGING;
+	init.barging = barging;
+	mu = init;
+	count = 0;
+
+	sched_stats_t before, after;
+	get_sched_stats(&before);
+	clock_t t = clock();
+	for (int i=0; i<TASKS; ++i)
+		spawn(worker, NULL_ARG);
+	for (int i=0; i<TASKS; ++i)
+		park(&done);
+	t = clock() - t;
+	get_sched_stats(&after);
+	assert(count == (long)TASKS*ITERS);
+	assert(!mu.locked && !mu.woken && !mu.starving);
+
+	double cpl = ((double)t)/((double)count);
+	printf("%s: %ld locks in %ld clocks, %llu switches\n", name, count, t,
+	       (unsigned long long)(after.runq_delay.count - before.runq_delay.count));
+	printf("%s: %f clocks per lock\n", name, cpl);
+}
+
+int main(void) {
+	puts("starting mutex benchmark...");
+	sched_stats_start(); /* for the switch counts */
+	spawn_budget(TASKS+1);
+	bench("handoff", 0);
+	bench("barging", 1);
+	return 0;
+}
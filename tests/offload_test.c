@@ -0,0 +1,86 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <chip/chip.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+
+#define please(expr) if ((expr) == -1) { perror(#expr); _exit(1); }
+
+#define WRITERS 16
+#define BLOCK   4096
+
+static ioctx_t file;
+static sema_t sema;
+static int ticks;
+static int sleeping;
+
+/* write one block at offset (n*BLOCK) */
+static void writer(word_t arg) {
+	char buf[BLOCK];
+	int n = (int)arg.val;
+
+	memset(buf, 'a'+n, BLOCK);
+	assert(ioctx_pwrite(&file, buf, BLOCK, (off_t)n*BLOCK) == BLOCK);
+	post(&sema);
+}
+
+static void nap(word_t arg) {
+	usleep(50000);
+}
+
+static void nop(word_t arg) {
+	return;
+}
+
+static void sleeper(word_t arg) {
+	sleeping = 1;
+	please(chip_offload(nap, arg));
+	sleeping = 0;
+	post(&sema);
+}
+
+int main(void) {
+	puts("running "__FILE__);
+
+	char path[] = "/tmp/chip-offload-XXXXXX";
+	int fd;
+	please(fd = mkstemp(path));
+	please(unlink(path));
+	please(ioctx_init(fd, &file));
+
+	for (int i=0; i<WRITERS; ++i) {
+		word_t arg;
+		arg.val = i;
+		spawn(writer, arg);
+	}
+	for (int i=0; i<WRITERS; ++i)
+		park(&sema);
+	
+	char buf[BLOCK];
+	for (int i=0; i<WRITERS; ++i) {
+		assert(ioctx_pread(&file, buf, BLOCK, (off_t)i*BLOCK) == BLOCK);
+		for (int j=0; j<BLOCK; ++j)
+			assert(buf[j] == 'a'+i);
+	}
+	assert(ioctx_pread(&file, buf, BLOCK, (off_t)WRITERS*BLOCK) == 0);
+
+	/* other offloaded work keeps completing while a worker sleeps */
+	spawn(sleeper, NULL_ARG);
+	sched();
+	assert(sleeping);
+	while (sleeping) {
+		please(chip_offload(nop, NULL_ARG));
+		++ticks;
+	}
+	park(&sema);
+	printf("%d offloads completed during a blocking offload\n", ticks);
+	assert(ticks > 0);
+
+	please(ioctx_destroy(&file));
+	puts(__FILE__ " passed.");
+	return 0;
+}
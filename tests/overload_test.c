@@ -0,0 +1,142 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <string.h>
+#include <assert.h>
+#include <chip/chip.h>
+#include <unistd.h>
+#include <errno.h>
+#include <time.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#define please(expr) if ((expr) == -1) { perror(#expr); _exit(1); }
+
+/* enough busy tasks to keep a standing queue well above the target */
+#define SPINNERS 20
+#define WORK_NS  20000
+#define TARGET_US 100
+
+static int stop;
+static int accepted[3];
+static int canceled[3];
+static ioctx_t lctx[3];
+static struct sockaddr_in addr[3];
+static sema_t done;
+static sema_t got;
+
+static long long now_ns(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec*1000000000LL + ts.tv_nsec;
+}
+
+static void spinner(word_t arg) {
+	while (!stop) {
+		long long t = now_ns();
+		while (now_ns() - t < WORK_NS) ;
+		sched();
+	}
+	post(&done);
+}
+
+static void acceptor(word_t arg) {
+	int fd;
+	while ((fd = ioctx_accept(&lctx[arg.val], NULL, NULL)) != -1) {
+		accepted[arg.val]++;
+		assert(write(fd, "hi", 2) == 2);
+		close(fd);
+		post(&got);
+	}
+	assert(errno == ECANCELED);
+	canceled[arg.val] = 1;
+}
+
+static void listener(int i, int mode) {
+	socklen_t len = sizeof(addr[i]);
+	memset(&addr[i], 0, sizeof(addr[i]));
+	addr[i].sin_family = AF_INET;
+	addr[i].sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	please(ioctx_listen(&lctx[i], (struct sockaddr *)&addr[i], sizeof(addr[i]), 16));
+	please(getsockname(lctx[i].fd, (struct sockaddr *)&addr[i], &len));
+	ioctx_shed(&lctx[i], mode);
+
+	word_t arg;
+	arg.val = i;
+	spawn(acceptor, arg);
+}
+
+/* connects to listener i and returns what it says */
+static ssize_t hello(int i, ioctx_t *ctx) {
+	char buf[4];
+	please(ioctx_connect(ctx, (struct sockaddr *)&addr[i], sizeof(addr[i])));
+	ssize_t amt = ioctx_read(ctx, buf, sizeof(buf));
+	please(ioctx_destroy(ctx));
+	return amt;
+}
+
+int main(void) {
+	puts("running "__FILE__);
+
+	ioctx_t c[3];
+	word_t arg;
+	arg.ptr = NULL;
+	spawn_budget(SPINNERS+4);
+	listener(0, SHED_CLOSE);
+	listener(1, SHED_PAUSE);
+	listener(2, SHED_PAUSE);
+	sched();
+
+	/* not overloaded to begin with */
+	assert(hello(0, &c[0]) == 2);
+	assert(accepted[0] == 1);
+	park(&got);
+
+	overload_control(TARGET_US, 5);
+	for (int i=0; i<SPINNERS; ++i)
+		spawn(spinner, arg);
+	long long t0 = now_ns();
+	while (!chip_overloaded()) {
+		sched();
+		assert(now_ns() - t0 < 2000000000LL);
+	}
+
+	/* shed by closing */
+	ssize_t amt = hello(0, &c[0]);
+	assert(amt == 0 || (amt == -1 && errno == ECONNRESET));
+	assert(accepted[0] == 1);
+
+	/* shed by pausing: the connection waits in the backlog */
+	please(ioctx_connect(&c[1], (struct sockaddr *)&addr[1], sizeof(addr[1])));
+	please(ioctx_connect(&c[2], (struct sockaddr *)&addr[2], sizeof(addr[2])));
+	t0 = now_ns();
+	while (now_ns() - t0 < 20000000LL) {
+		sched();
+		assert(chip_overloaded());
+	}
+	assert(accepted[1] == 0);
+
+	/* destroying a paused listener cancels its acceptor right away */
+	assert(accepted[2] == 0 && !canceled[2]);
+	please(ioctx_destroy(&lctx[2]));
+	assert(canceled[2]);
+	please(ioctx_destroy(&c[2]));
+
+	/* once the queue drains, it's accepted */
+	stop = 1;
+	for (int i=0; i<SPINNERS; ++i)
+		park(&done);
+	park(&got);
+	assert(!chip_overloaded());
+	assert(accepted[1] == 1);
+	char buf[4];
+	assert(ioctx_read(&c[1], buf, sizeof(buf)) == 2);
+	please(ioctx_destroy(&c[1]));
+
+	overload_control(0, 0);
+	please(ioctx_destroy(&lctx[0]));
+	please(ioctx_destroy(&lctx[1]));
+	sched();
+	puts(__FILE__ " passed.");
+	return 0;
+}
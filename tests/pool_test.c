@@ -0,0 +1,86 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdint.h>
+#include <assert.h>
+#include <chip/chip.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+
+#define please(expr) if ((expr) == -1) { perror(#expr); _exit(1); }
+
+/* a pool of readers sharing one pipe */
+#define WORKERS 8
+#define MSGS    100000
+
+static ioctx_t rctx;
+static unsigned char seen[MSGS];
+static int count[WORKERS];
+static int total;
+static sema_t all_read;
+static sema_t done;
+
+static void worker(word_t arg) {
+	uint64_t v;
+	ssize_t amt;
+
+	for (;;) {
+		amt = ioctx_read(&rctx, (char *)&v, sizeof(v));
+		if (amt == -1) {
+			assert(errno == ECANCELED);
+			break;
+		}
+		assert(amt == sizeof(v));
+		assert(v < MSGS && !seen[v]);
+		seen[v] = 1;
+		count[arg.val]++;
+		if (++total == MSGS)
+			post(&all_read);
+
+		/* give the other workers a chance */
+		if (v%16 == 0)
+			sched();
+	}
+	post(&done);
+}
+
+int main(void) {
+	puts("running "__FILE__);
+
+	int pipefd[2];
+	please(pipe(pipefd));
+	fcntl(pipefd[0], F_SETFL, O_NONBLOCK|(fcntl(pipefd[0], F_GETFL)));
+	fcntl(pipefd[1], F_SETFL, O_NONBLOCK|(fcntl(pipefd[1], F_GETFL)));
+
+	ioctx_t wctx;
+	please(ioctx_init(pipefd[0], &rctx));
+	please(ioctx_init(pipefd[1], &wctx));
+
+	for (int i=0; i<WORKERS; ++i) {
+		word_t arg;
+		arg.val = i;
+		spawn(worker, arg);
+	}
+
+	uint64_t batch[8];
+	for (uint64_t i=0; i<MSGS; i += 8) {
+		for (int j=0; j<8; ++j)
+			batch[j] = i+j;
+		assert(ioctx_write(&wctx, (char *)batch, sizeof(batch)) == sizeof(batch));
+	}
+	park(&all_read);
+
+	int busy = 0;
+	for (int i=0; i<WORKERS; ++i)
+		busy += count[i] > 0;
+	assert(busy > 1);
+
+	/* every waiter is canceled, not just the first */
+	please(ioctx_destroy(&rctx));
+	for (int i=0; i<WORKERS; ++i)
+		park(&done);
+
+	please(ioctx_destroy(&wctx));
+	puts(__FILE__ " passed.");
+	return 0;
+}
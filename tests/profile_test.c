@@ -0,0 +1,103 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <chip/chip.h>
+#include <unistd.h>
+#include <time.h>
+
+#define please(expr) if ((expr) == -1) { perror(#expr); _exit(1); }
+
+#define BURNERS 4
+
+static volatile unsigned long sink;
+static int stop;
+static sema_t done;
+
+static void burner(word_t arg) {
+	while (!stop) {
+		for (int i=0; i<100000; ++i)
+			sink += i;
+		sched();
+	}
+	post(&done);
+}
+
+static double cpu_seconds(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &ts);
+	return ts.tv_sec + ts.tv_nsec/1e9;
+}
+
+/* writing doesn't need a big stack */
+static void writer(word_t arg) {
+	please(chip_profile_write(arg.fd, 0));
+	post(&done);
+}
+
+/* sums the counts of the folded lines that start with 'root' */
+static long count_rooted(FILE *f, const char *root, int *tasks) {
+	char line[4096];
+	long total = 0;
+	rewind(f);
+	while (fgets(line, sizeof(line), f)) {
+		char *sp = strrchr(line, ' ');
+		assert(sp != NULL);
+		if (strncmp(line, root, strlen(root)) == 0) {
+			total += atol(sp+1);
+			*tasks += strstr(line, ";task@") != NULL;
+		}
+	}
+	return total;
+}
+
+int main(void) {
+	puts("running "__FILE__);
+
+	assert(chip_profile_start(0) == -1);
+	/* one per second is a whole second, not 1000000us */
+	please(chip_profile_start(1));
+	please(chip_profile_start(1000));
+
+	word_t arg;
+	arg.ptr = NULL;
+	spawn_budget(BURNERS+1);
+	for (int i=0; i<BURNERS; ++i)
+		spawn(burner, arg);
+	double t0 = cpu_seconds();
+	while (cpu_seconds() - t0 < 0.2)
+		sched();
+	stop = 1;
+	for (int i=0; i<BURNERS; ++i)
+		park(&done);
+	chip_profile_stop();
+
+	char root[32];
+	word_t start;
+	start.fnptr = (void (*)(void))burner;
+	snprintf(root, sizeof(root), "%#lx;", (unsigned long)start.val);
+
+	FILE *f = tmpfile();
+	assert(f != NULL);
+	please(chip_profile_write(fileno(f), CHIP_PROFILE_TASKS));
+	int tasks = 0;
+	long samples = count_rooted(f, root, &tasks);
+	/* 0.2s of CPU, at 1kHz or the kernel's tick rate, nearly all in the burners */
+	assert(samples > 20);
+	assert(tasks > 0);
+	fclose(f);
+
+	/* the samples were consumed */
+	f = tmpfile();
+	assert(f != NULL);
+	arg.fd = fileno(f);
+	spawn(writer, arg);
+	park(&done);
+	tasks = 0;
+	assert(count_rooted(f, root, &tasks) == 0);
+	fclose(f);
+
+	puts(__FILE__ " passed.");
+	return 0;
+}
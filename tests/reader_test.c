@@ -0,0 +1,130 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <chip/chip.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+
+#define please(expr) if ((expr) == -1) { perror(#expr); _exit(1); }
+
+/*
+ * the writer sends LINES pipelined "header" lines,
+ * each followed by a binary frame, in awkwardly-sized
+ * chunks; the reader parses them with an ioreader_t.
+ */
+#define LINES 2000
+#define CHUNK 37
+
+static sema_t done;
+static char out[1<<20];
+static char rdbuf[4096];
+
+/* line i has a body of (i%300) bytes, so some lines span many vectors */
+static size_t fmt_msg(char *p, int i) {
+	size_t n = 0;
+	int len = i%300;
+
+	n += sprintf(p, "%d %d:", i, len);
+	for (int j=0; j<len; ++j)
+		p[n++] = 'a' + (i+j)%26;
+	
+	/* a lone '\r' must not end the line */
+	p[n++] = '\r';
+	p[n++] = '.';
+	p[n++] = '\r';
+	p[n++] = '\n';
+	for (int j=0; j<len; ++j)
+		p[n++] = (char)(i*j);
+	
+	return n;
+}
+
+static void reader(word_t arg) {
+	ioctx_t ctx;
+	ioreader_t rd;
+	char *msg;
+	ssize_t amt;
+
+	please(ioctx_init(arg.fd, &ctx));
+	ioreader_init(&rd, &ctx, rdbuf, sizeof(rdbuf));
+	for (int i=0; i<LINES; ++i) {
+		int num, len, off;
+
+		please(amt = ioctx_read_until(&rd, "\r\n", 2, &msg));
+		assert(amt > 0);
+		assert(sscanf(msg, "%d %d:%n", &num, &len, &off) == 2);
+		assert(num == i);
+		assert(len == i%300);
+		assert(amt == off + len + 4);
+		for (int j=0; j<len; ++j)
+			assert(msg[off+j] == 'a' + (i+j)%26);
+		
+		please(amt = ioctx_read_exact(&rd, len, &msg));
+		assert(amt == len);
+		for (int j=0; j<len; ++j)
+			assert(msg[j] == (char)(i*j));
+	}
+	
+	/* a trailing partial line stays buffered */
+	assert(ioctx_read_until(&rd, "\r\n", 2, &msg) == 0);
+	assert(ioctx_peek(&rd, &msg) == 4);
+	assert(memcmp(msg, "tail", 4) == 0);
+	assert(ioctx_read_exact(&rd, sizeof(rdbuf)+1, &msg) == -1 && errno == EINVAL);
+	assert(ioctx_read_until(&rd, "", 0, &msg) == -1 && errno == EINVAL);
+	please(ioctx_destroy(&ctx));
+	post(&done);
+}
+
+int main(void) {
+	puts("running "__FILE__);
+
+	size_t len = 0;
+	for (int i=0; i<LINES; ++i)
+		len += fmt_msg(out+len, i);
+	memcpy(out+len, "tail", 4);
+	len += 4;
+	
+	int pipefd[2];
+	please(pipe(pipefd));
+	fcntl(pipefd[0], F_SETFL, O_NONBLOCK|(fcntl(pipefd[0], F_GETFL)));
+	fcntl(pipefd[1], F_SETFL, O_NONBLOCK|(fcntl(pipefd[1], F_GETFL)));
+
+	word_t arg;
+	arg.fd = pipefd[0];
+	spawn(reader, arg);
+
+	ioctx_t wctx;
+	please(ioctx_init(pipefd[1], &wctx));
+	for (size_t off = 0; off < len; ) {
+		size_t n = len - off < CHUNK ? len - off : CHUNK;
+		ssize_t w;
+		please(w = ioctx_write(&wctx, out + off, n));
+		off += w;
+		if (off % (CHUNK*8) < CHUNK)
+			sched();
+	}
+	please(ioctx_destroy(&wctx));
+	park(&done);
+
+	/* a message bigger than the buffer */
+	please(pipe(pipefd));
+	fcntl(pipefd[0], F_SETFL, O_NONBLOCK|(fcntl(pipefd[0], F_GETFL)));
+	memset(out, 'x', 100);
+	please(write(pipefd[1], out, 100));
+
+	ioctx_t rctx;
+	ioreader_t rd;
+	char small[16];
+	char *msg;
+	please(ioctx_init(pipefd[0], &rctx));
+	ioreader_init(&rd, &rctx, small, sizeof(small));
+	assert(ioctx_read_until(&rd, "\n", 1, &msg) == -1 && errno == ENOBUFS);
+	please(ioctx_destroy(&rctx));
+	close(pipefd[1]);
+
+	puts(__FILE__ " passed.");
+	return 0;
+}
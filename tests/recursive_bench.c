@@ -10,6 +10,9 @@
  */
 #define INCS 1000000
 
+/* eager allocation budget for the second run */
+#define BUDGET 1024
+
 static int count;
 static sema_t sema;
 
@@ -23,9 +26,10 @@ static void inc(word_t ignored) {
 	return;
 }
 
-int main(void) {
-	puts("running sequential stack switch test...");
-	
+static void bench(int budget) {
+	count = 0;
+	spawn_budget(budget);
+
 	/* spawn tasks that run 'inc' */
 	clock_t t = clock();
 	spawn(inc, NULL_ARG);
@@ -34,7 +38,13 @@ int main(void) {
 	assert(sema.count == 0);
 	assert(count == INCS);
 	double cpp = ((double)t)/((double)INCS);
-	printf("%d recursive spawns in %ld clocks\n", INCS, t);
-	printf("%f clocks per spawn\n", cpp);
+	printf("budget %d: %d recursive spawns in %ld clocks\n", budget, INCS, t);
+	printf("budget %d: %f clocks per spawn\n", budget, cpp);
+}
+
+int main(void) {
+	puts("running recursive spawn test...");
+	bench(0);
+	bench(BUDGET);
 	return 0;
 }
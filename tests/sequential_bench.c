@@ -10,6 +10,9 @@
  */
 #define INCS 1000000
 
+/* eager allocation budget for the second run */
+#define BUDGET 1024
+
 static int count;
 static sema_t sema;
 
@@ -20,9 +23,10 @@ static void inc(word_t ignored) {
 	return;
 }
 
-int main(void) {
-	puts("running sequential stack switch test...");
-	
+static void bench(int budget) {
+	count = 0;
+	spawn_budget(budget);
+
 	/* spawn tasks that run 'inc' */
 	clock_t t = clock();
 	word_t zero;
@@ -35,7 +39,30 @@ int main(void) {
 	assert(sema.count == 0);
 	assert(count == INCS);
 	double cpp = ((double)t)/((double)INCS);
-	printf("%d stack switches in %ld clocks\n", INCS, t);
-	printf("%f clocks per stack switch\n", cpp);
+	printf("budget %d: %d stack switches in %ld clocks\n", budget, INCS, t);
+	printf("budget %d: %f clocks per stack switch\n", budget, cpp);
+}
+
+static void bench_inline(void) {
+	count = 0;
+
+	clock_t t = clock();
+	for (int i=0; i<INCS; ++i) {
+		spawn_inline(inc, NULL_ARG);
+	}
+	park(&sema);
+	t = clock() - t;
+	assert(sema.count == 0);
+	assert(count == INCS);
+	double cpp = ((double)t)/((double)INCS);
+	printf("inline: %d calls in %ld clocks\n", INCS, t);
+	printf("inline: %f clocks per call\n", cpp);
+}
+
+int main(void) {
+	puts("running sequential stack switch test...");
+	bench(0);
+	bench(BUDGET);
+	bench_inline();
 	return 0;
 }
@@ -0,0 +1,83 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <assert.h>
+#include <chip/chip.h>
+#include <chip/stats.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+
+#define TASKS 100
+
+static int exited;
+
+static void yielder(word_t arg) {
+	for (int i=0; i<10; ++i)
+		sched();
+	exited++;
+}
+
+static void nap(word_t arg) {
+	usleep(20000);
+}
+
+static uint64_t total(const hist_t *h) {
+	uint64_t n = 0;
+	for (int i=0; i<HIST_BUCKETS; ++i)
+		n += h->buckets[i];
+	return n;
+}
+
+int main(void) {
+	puts("running "__FILE__);
+
+	word_t arg;
+	arg.ptr = NULL;
+	sched_stats_start();
+	for (int i=0; i<TASKS; ++i)
+		spawn(yielder, arg);
+	while (exited < TASKS)
+		sched();
+
+	/* blocks in the poller for ~20ms */
+	chip_offload(nap, arg);
+
+	sched_stats_t st;
+	get_sched_stats(&st);
+	assert(st.lifetime.count == TASKS);
+	assert(st.runq_delay.count >= TASKS*10);
+	assert(st.poll_block.count >= 1);
+	assert(st.poll_block.sum >= 10000000);
+	assert(st.poll_events.count == st.runq_len.count);
+	assert(st.poll_events.sum >= 1);
+
+	assert(total(&st.runq_delay) == st.runq_delay.count);
+	assert(total(&st.poll_block) == st.poll_block.count);
+	assert(total(&st.lifetime) == st.lifetime.count);
+	assert(total(&st.runq_len) == st.runq_len.count);
+
+	/* the shared segment reflects the same counters */
+	char name[32];
+	assert(chip_stats_publish() == 0);
+	snprintf(name, sizeof(name), "/chip-%d", (int)getpid());
+	int fd = shm_open(name, O_RDONLY, 0);
+	assert(fd != -1);
+	const chip_stats_seg_t *seg = mmap(NULL, sizeof(*seg), PROT_READ, MAP_SHARED, fd, 0);
+	assert(seg != MAP_FAILED);
+	close(fd);
+	assert(seg->magic == CHIP_STATS_MAGIC);
+	assert(seg->pid == getpid());
+	assert(seg->nthreads == 1);
+	assert(seg->threads[0].exits == TASKS);
+	assert(seg->threads[0].switches >= TASKS*10);
+	assert(seg->threads[0].highwater >= 1);
+
+	/* polling refreshes the slot */
+	uint64_t polls = seg->threads[0].polls;
+	chip_offload(nap, arg);
+	assert(seg->threads[0].polls > polls);
+	assert(chip_stats_publish() == 0);
+	assert(seg->nthreads == 1);
+	puts(__FILE__ " passed.");
+	return 0;
+}
@@ -0,0 +1,116 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <string.h>
+#include <assert.h>
+#include <chip/chip.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <errno.h>
+
+#define please(expr) if ((expr) == -1) { perror(#expr); _exit(1); }
+
+/* much bigger than a task stack */
+#define BIG 65536
+
+static sema_t sema;
+
+typedef struct {
+	int  in;
+	long out;
+	char msg[64];
+} work_t;
+
+static void hungry(word_t arg) {
+	work_t *w = arg.ptr;
+	volatile char buf[BIG];
+
+	for (int i=0; i<BIG; ++i)
+		buf[i] = (char)(w->in + i);
+
+	w->out = 0;
+	for (int i=0; i<BIG; ++i)
+		w->out += buf[i];
+
+	snprintf(w->msg, sizeof(w->msg), "sum %ld", w->out);
+}
+
+static void task(word_t arg) {
+	work_t *want = arg.ptr;
+	work_t w;
+	word_t warg;
+
+	memset(&w, 0, sizeof(w));
+	w.in = want->in;
+	warg.ptr = &w;
+	chip_call_on_system_stack(hungry, warg);
+
+	/* check against the same computation on main()'s stack */
+	assert(w.out == want->out);
+	assert(strcmp(w.msg, want->msg) == 0);
+	post(&sema);
+}
+
+/* reads from a pipe that never has data */
+static void blocks(word_t arg) {
+	char c;
+	ioctx_read(arg.ptr, &c, 1);
+}
+
+static void blocker(word_t arg) {
+	chip_call_on_system_stack(blocks, arg);
+}
+
+/* chip's wait() takes the name, so declare this one ourselves */
+pid_t waitpid(pid_t pid, int *status, int options);
+
+/* blocking aborts right away, rather than waiting in the poller first */
+static void check_blocking(void) {
+	int pipefd[2];
+	int status;
+	pid_t pid;
+
+	please(pipe(pipefd));
+	please(pid = fork());
+	if (pid == 0) {
+		ioctx_t ctx;
+		sema_t never = {0};
+		fcntl(pipefd[0], F_SETFL, O_NONBLOCK|(fcntl(pipefd[0], F_GETFL)));
+		please(ioctx_init(pipefd[0], &ctx));
+		close(STDERR_FILENO);
+		alarm(10); /* SIGALRM, not SIGABRT, if it hangs */
+
+		word_t arg;
+		arg.ptr = &ctx;
+		spawn(blocker, arg);
+		park(&never);
+		_exit(0);
+	}
+	while (waitpid(pid, &status, 0) == -1)
+		assert(errno == EINTR);
+	assert(WIFSIGNALED(status) && WTERMSIG(status) == SIGABRT);
+	close(pipefd[0]);
+	close(pipefd[1]);
+}
+
+int main(void) {
+	puts("running "__FILE__);
+
+	work_t want;
+	word_t warg;
+	memset(&want, 0, sizeof(want));
+	want.in = 7;
+	warg.ptr = &want;
+	hungry(warg);
+	
+	for (int i=0; i<10; ++i)
+		spawn(task, warg);
+	
+	for (int i=0; i<10; ++i)
+		park(&sema);
+
+	check_blocking();
+	puts(__FILE__ " passed.");
+	return 0;
+}
@@ -0,0 +1,108 @@
+#include <stdio.h>
+#include <string.h>
+#include <assert.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <netinet/in.h>
+#include <chip/chip.h>
+
+#define please(expr) if ((expr) == -1) { perror(#expr); _exit(1); }
+
+/*
+ * run a runtime on each of THREADS threads,
+ * and bounce PINGS messages off of each of them.
+ */
+#define THREADS 4
+#define PINGS   10000
+#define ROUND   100 /* keep THREADS*ROUND below the mailbox size */
+
+static chip_rt_t *home;
+static chip_rt_t *peers[THREADS];
+static int        npeers;
+static int        pongs;
+static sema_t     ready;
+static sema_t     done;
+
+/* per-thread */
+static _Thread_local sema_t quit;
+static _Thread_local int    pinged;
+
+static void hello(word_t arg) {
+	peers[npeers++] = arg.ptr;
+	if (npeers == THREADS)
+		post(&ready);
+}
+
+static void pong(word_t arg) {
+	if (++pongs % (THREADS*ROUND) == 0)
+		post(&done);
+}
+
+static void ping(word_t arg) {
+	++pinged;
+	assert(chip_post(home, pong, arg) == 0);
+}
+
+static void stop(word_t arg) {
+	post(&quit);
+}
+
+static void *thread_main(void *arg) {
+	chip_init();
+	word_t self;
+	self.ptr = chip_self();
+	assert(self.ptr != NULL);
+	assert(chip_post(home, hello, self) == 0);
+	
+	park(&quit);
+	assert(pinged == PINGS);
+	return NULL;
+}
+
+static void test_reuseport(void) {
+	ioctx_t a, b;
+	struct sockaddr_in addr;
+	socklen_t len = sizeof(addr);
+
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	addr.sin_port = 0;
+	please(ioctx_listen(&a, (struct sockaddr *)&addr, sizeof(addr), 16));
+
+	/* a second listener on the same port */
+	please(getsockname(a.fd, (struct sockaddr *)&addr, &len));
+	please(ioctx_listen(&b, (struct sockaddr *)&addr, sizeof(addr), 16));
+	please(ioctx_destroy(&a));
+	please(ioctx_destroy(&b));
+}
+
+int main(void) {
+	pthread_t threads[THREADS];
+
+	puts("running "__FILE__);
+	test_reuseport();
+
+	home = chip_self();
+	assert(home != NULL);
+	for (int i=0; i<THREADS; ++i)
+		assert(pthread_create(&threads[i], NULL, thread_main, NULL) == 0);
+
+	park(&ready);
+	for (int i=0; i<PINGS; i += ROUND) {
+		for (int j=0; j<THREADS; ++j) {
+			for (int k=0; k<ROUND; ++k)
+				assert(chip_post(peers[j], ping, NULL_ARG) == 0);
+		}
+		park(&done);
+	}
+	assert(pongs == THREADS*PINGS);
+
+	for (int i=0; i<THREADS; ++i)
+		assert(chip_post(peers[i], stop, NULL_ARG) == 0);
+	for (int i=0; i<THREADS; ++i)
+		assert(pthread_join(threads[i], NULL) == 0);
+	
+	puts(__FILE__ " passed.");
+	return 0;
+}
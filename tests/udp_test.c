@@ -0,0 +1,124 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <string.h>
+#include <assert.h>
+#include <chip/chip.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#define please(expr) if ((expr) == -1) { perror(#expr); _exit(1); }
+
+#define MSGS 100
+#define SEG  100
+
+static ioctx_t rx, tx;
+static struct sockaddr_in rxaddr, txaddr;
+static sema_t done;
+
+static int udp_socket(ioctx_t *ctx, struct sockaddr_in *addr) {
+	socklen_t len = sizeof(*addr);
+	int fd = socket(AF_INET, SOCK_DGRAM|SOCK_NONBLOCK|SOCK_CLOEXEC, 0);
+	if (fd == -1)
+		return -1;
+	memset(addr, 0, sizeof(*addr));
+	addr->sin_family = AF_INET;
+	addr->sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	if (bind(fd, (struct sockaddr *)addr, sizeof(*addr)) == -1 ||
+	    getsockname(fd, (struct sockaddr *)addr, &len) == -1)
+		return -1;
+	return ioctx_init(fd, ctx);
+}
+
+/* receives MSGS numbered datagrams, in pooled buffers */
+static void receiver(word_t arg) {
+	dgram_t msgs[32];
+	int seen = 0;
+
+	while (seen < MSGS) {
+		int n;
+		for (int i=0; i<32; ++i) {
+			msgs[i].buf = NULL;
+			msgs[i].cap = 2048;
+		}
+		please(n = ioctx_recv_dgrams(&rx, msgs, 32));
+		assert(n > 0);
+		for (int i=0; i<n; ++i) {
+			struct sockaddr_in *from = (struct sockaddr_in *)&msgs[i].addr;
+			int v;
+			assert(msgs[i].len == sizeof(v));
+			assert(from->sin_port == txaddr.sin_port);
+			memcpy(&v, msgs[i].buf, sizeof(v));
+			assert(v == seen++);
+			iobuf_put(msgs[i].buf);
+		}
+		for (int i=n; i<32; ++i)
+			assert(msgs[i].buf == NULL);
+	}
+	post(&done);
+}
+
+int main(void) {
+	puts("running "__FILE__);
+
+	please(udp_socket(&rx, &rxaddr));
+	please(udp_socket(&tx, &txaddr));
+
+	/* the receiver blocks before anything is sent */
+	word_t arg;
+	arg.ptr = NULL;
+	spawn(receiver, arg);
+	sched();
+
+	int vals[MSGS];
+	dgram_t out[MSGS];
+	for (int i=0; i<MSGS; ++i) {
+		vals[i] = i;
+		memset(&out[i], 0, sizeof(out[i]));
+		out[i].buf = (char *)&vals[i];
+		out[i].len = sizeof(vals[i]);
+		memcpy(&out[i].addr, &rxaddr, sizeof(rxaddr));
+		out[i].addrlen = sizeof(rxaddr);
+	}
+	assert(ioctx_send_dgrams(&tx, out, MSGS) == MSGS);
+	park(&done);
+
+#ifdef __linux__
+	/* one send of 10 segments arrives as 10 datagrams, or as 1 with GRO */
+	char big[10*SEG], in[10*SEG];
+	for (size_t i=0; i<sizeof(big); ++i)
+		big[i] = (char)i;
+	int gro = ioctx_udp_gro(&rx) == 0;
+
+	dgram_t m;
+	memset(&m, 0, sizeof(m));
+	m.buf = big;
+	m.len = sizeof(big);
+	m.segsize = SEG;
+	memcpy(&m.addr, &rxaddr, sizeof(rxaddr));
+	m.addrlen = sizeof(rxaddr);
+	if (ioctx_send_dgrams(&tx, &m, 1) == 1) {
+		size_t got = 0;
+		while (got < sizeof(big)) {
+			dgram_t r;
+			r.buf = in+got;
+			r.cap = sizeof(in)-got;
+			please(ioctx_recv_dgrams(&rx, &r, 1));
+			assert(r.segsize == 0 || (gro && r.segsize == SEG));
+			assert(r.segsize || r.len == SEG);
+			got += r.len;
+		}
+		assert(memcmp(big, in, sizeof(big)) == 0);
+	} else {
+		/* kernel without UDP_SEGMENT */
+		assert(errno == EINVAL || errno == ENOPROTOOPT || errno == EIO);
+	}
+#endif
+
+	please(ioctx_destroy(&rx));
+	please(ioctx_destroy(&tx));
+	puts(__FILE__ " passed.");
+	return 0;
+}
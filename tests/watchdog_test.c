@@ -0,0 +1,81 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <string.h>
+#include <assert.h>
+#include <chip/chip.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <time.h>
+#include <errno.h>
+
+#define please(expr) if ((expr) == -1) { perror(#expr); _exit(1); }
+
+static int other_ran;
+static int hog_yielded;
+static sema_t done;
+
+static long now_ms(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec*1000 + ts.tv_nsec/1000000;
+}
+
+/* spins, but honors preemption requests */
+static void hog(word_t arg) {
+	long start = now_ms();
+	while (!other_ran && now_ms() - start < 2000)
+		chip_maybe_yield();
+	hog_yielded = other_ran;
+	post(&done);
+}
+
+static void other(word_t arg) {
+	other_ran = 1;
+	post(&done);
+}
+
+static void nap(word_t arg) {
+	usleep(100000);
+}
+
+int main(void) {
+	puts("running "__FILE__);
+
+	/* capture stderr */
+	int errpipe[2], saved;
+	please(pipe(errpipe));
+	fcntl(errpipe[0], F_SETFL, O_NONBLOCK|(fcntl(errpipe[0], F_GETFL)));
+	please(saved = dup(STDERR_FILENO));
+	please(dup2(errpipe[1], STDERR_FILENO));
+
+	please(chip_watchdog(20));
+
+	/* waiting in the poller isn't a stall */
+	word_t arg;
+	arg.ptr = NULL;
+	please(chip_offload(nap, arg));
+	char buf[256];
+	assert(read(errpipe[0], buf, sizeof(buf)) == -1 && errno == EAGAIN);
+
+	spawn_budget(4);
+	spawn(hog, arg);
+	spawn(other, arg);
+	park(&done);
+	park(&done);
+	assert(hog_yielded);
+
+	ssize_t amt = read(errpipe[0], buf, sizeof(buf)-1);
+	assert(amt > 0);
+	buf[amt] = 0;
+	assert(strstr(buf, "without yielding") != NULL);
+
+	please(chip_watchdog(0));
+
+	/* stopping waits for the thread, so it can be started again right away */
+	please(chip_watchdog(1000));
+	please(chip_watchdog(0));
+	please(chip_watchdog(0));
+	please(dup2(saved, STDERR_FILENO));
+	puts(__FILE__ " passed.");
+	return 0;
+}
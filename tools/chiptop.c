@@ -0,0 +1,120 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <chip/stats.h>
+
+/*
+ * chiptop <pid> [interval-ms]
+ *
+ * Displays the statistics that a chip program published
+ * with chip_stats_publish() (or CHIP_STATS=1 in its environment).
+ */
+
+static const chip_stats_seg_t *seg;
+static chip_stats_thread_t prev[CHIP_STATS_THREADS];
+
+/* copy a slot without tearing; fails if the writer never settles */
+static int snapshot(const chip_stats_thread_t *src, chip_stats_thread_t *dst) {
+	for (int tries=0; tries<1000; ++tries) {
+		unsigned seq = atomic_load_explicit(&src->seq, memory_order_acquire);
+		if (seq&1)
+			continue;
+		dst->runnable = src->runnable;
+		dst->parked = src->parked;
+		dst->iowait = src->iowait;
+		dst->live = src->live;
+		dst->highwater = src->highwater;
+		dst->mapped = src->mapped;
+		dst->switches = src->switches;
+		dst->polls = src->polls;
+		dst->iocalls = src->iocalls;
+		dst->exits = src->exits;
+		dst->updated = src->updated;
+		atomic_thread_fence(memory_order_acquire);
+		if (atomic_load_explicit(&src->seq, memory_order_relaxed) == seq)
+			return 0;
+	}
+	return -1;
+}
+
+static double rate(uint64_t now, uint64_t then, int64_t nsec) {
+	return nsec > 0 ? (double)(now - then) * 1e9 / nsec : 0;
+}
+
+static void show(int pid) {
+	int n = atomic_load_explicit(&seg->nthreads, memory_order_acquire);
+
+	printf("\033[H\033[2Jpid %d: %d thread(s)\n\n", pid, n);
+	printf("%3s %8s %8s %8s %8s %8s %10s %12s %10s %10s %10s\n",
+		"thr", "run", "parked", "iowait", "live", "high", "mapped(K)",
+		"switch/s", "poll/s", "io/s", "exit/s");
+	for (int i=0; i<n && i<CHIP_STATS_THREADS; ++i) {
+		chip_stats_thread_t cur;
+		if (snapshot(&seg->threads[i], &cur) == -1) {
+			printf("%3d (busy)\n", i);
+			continue;
+		}
+		int64_t dt = prev[i].updated ? cur.updated - prev[i].updated : 0;
+		printf("%3d %8d %8d %8d %8d %8d %10llu %12.0f %10.0f %10.0f %10.0f\n",
+			i, cur.runnable, cur.parked, cur.iowait, cur.live, cur.highwater,
+			(unsigned long long)(cur.mapped/1024),
+			rate(cur.switches, prev[i].switches, dt),
+			rate(cur.polls, prev[i].polls, dt),
+			rate(cur.iocalls, prev[i].iocalls, dt),
+			rate(cur.exits, prev[i].exits, dt));
+		prev[i] = cur;
+	}
+	fflush(stdout);
+}
+
+int main(int argc, char **argv) {
+	if (argc < 2 || argc > 3) {
+		fprintf(stderr, "usage: %s <pid> [interval-ms]\n", argv[0]);
+		return 2;
+	}
+	int pid = atoi(argv[1]);
+	int ms = argc == 3 ? atoi(argv[2]) : 1000;
+	if (pid <= 0 || ms <= 0) {
+		fprintf(stderr, "%s: bad argument\n", argv[0]);
+		return 2;
+	}
+
+	char name[32];
+	snprintf(name, sizeof(name), "/chip-%d", pid);
+	int fd = shm_open(name, O_RDONLY, 0);
+	if (fd == -1) {
+		fprintf(stderr, "%s: %s: %s\n", argv[0], name, strerror(errno));
+		return 1;
+	}
+	void *mem = mmap(NULL, sizeof(chip_stats_seg_t), PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if (mem == MAP_FAILED) {
+		perror("mmap");
+		return 1;
+	}
+	seg = mem;
+	if (seg->magic != CHIP_STATS_MAGIC || seg->version != CHIP_STATS_VERSION) {
+		fprintf(stderr, "%s: %s: not a chip stats segment (or wrong version)\n", argv[0], name);
+		return 1;
+	}
+
+	struct timespec ts;
+	ts.tv_sec = ms/1000;
+	ts.tv_nsec = (long)(ms%1000) * 1000000;
+	for (;;) {
+		/* a segment left behind by a process that crashed */
+		if (kill(seg->pid, 0) == -1 && errno == ESRCH) {
+			fprintf(stderr, "%s: process %d has exited\n", argv[0], pid);
+			return 1;
+		}
+		show(pid);
+		nanosleep(&ts, NULL);
+	}
+}